@@ -305,6 +305,8 @@
 #define XBORN0             0.25
 #define EBORN              100.0
 #define MAXCECACHE         1000000
+#define MAXCEPKSTORE       268435456L
+#define CEPKSTORE_NH       65536
 
 /* ionization */
 #define IONMAXK            6
@@ -3867,7 +3867,10 @@ int MemENTable(char *fn) {
     }
   }
 
-  if (nlevels > 0) {
+  if (nlevels > 0 && r.name[0] == '\0') {
+    /* level names not saved, UTA records have j < 0 */
+    iuta = r.j < 0;
+  } else if (nlevels > 0) {
     s = r.name;
     iuta = 1;
     while (*s) {
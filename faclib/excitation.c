@@ -454,6 +454,278 @@ int SetCEPWGrid(int ns, int *n, int *step) {
   return 0;
 }
 
+/*
+** partial wave extrapolation. CERadialPk stops the partial wave loop
+** once the direct strengths of the last three waves decrease
+** geometrically and the tail of that series is below pw_extrap.tol of
+** the partial sum, at every energy of tegrid. the shorter CEPK is then
+** topped up by the Coulomb-Bethe or geometric tail in CERadialQkTable,
+** as for the waves beyond max_kl. tol = 0 disables it.
+*/
+typedef struct _CEPW_EXTRAP_ {
+  double tol;
+  int stats;
+  long npk, nstop, nkl, nsaved;
+} CEPW_EXTRAP;
+
+static CEPW_EXTRAP pw_extrap = {0.0, 0, 0, 0, 0, 0};
+
+void PrintCEPWExtrap(void) {
+  MPrintf(-1, "CEPW extrap: pk=%ld stop=%ld kl=%ld saved=%ld tol=%g\n",
+	  pw_extrap.npk, pw_extrap.nstop, pw_extrap.nkl, pw_extrap.nsaved,
+	  pw_extrap.tol);
+}
+
+/* 1 if the waves 0..t-1 of xd (direct) and xt (total) have converged */
+static int ConvergedCEPW(int t, double xd[][MAXNTE], double xt[][MAXNTE]) {
+  int i, j;
+  double *kl, c0, c1, s, a;
+
+  if (t < 3) return 0;
+  kl = pw_scratch.kl;
+  for (i = 0; i < n_tegrid; i++) {
+    if (xd[t-1][i] <= 0 || xd[t-2][i] <= 0 || xd[t-3][i] <= 0) return 0;
+    c0 = pow(xd[t-1][i]/xd[t-2][i], 1.0/(kl[t-1]-kl[t-2]));
+    c1 = pow(xd[t-2][i]/xd[t-3][i], 1.0/(kl[t-2]-kl[t-3]));
+    if (c0 >= 1 || c1 >= 1) return 0;
+    /* the ratio must not drift towards 1 */
+    if (1-c0 < 0.5*(1-c1)) return 0;
+    if (c0 < c1) c0 = c1;
+    s = xt[0][i];
+    for (j = 1; j < t; j++) {
+      s += xt[j][i];
+      a = kl[j] - kl[j-1] - 1;
+      if (a > 0) s += a*sqrt(fabs(xt[j][i]*xt[j-1][i]));
+    }
+    a = xd[t-1][i]*c0/(1-c0);
+    if (a > pw_extrap.tol*s) return 0;
+  }
+  return 1;
+}
+
+/*
+** the CEPK entries of pk_array are freed after each energy subrange
+** of SaveExcitation. the pk store keeps copies of them across the
+** subranges and calls, keyed by the orbital pair, the multipole, the
+** energies and the partial wave grid, up to pk_store.maxsize bytes.
+** the oldest entries are dropped first. it is emptied by a full
+** ReinitExcitation.
+*/
+typedef struct _CEPK_SENTRY_ {
+  int k, k0, k1, nte;
+  double e1, te[MAXNTE];
+  double ek0, ek1;
+  unsigned long cx, key;
+  long size;
+  CEPK pk;
+  struct _CEPK_SENTRY_ *next, *newer;
+} CEPK_SENTRY;
+
+typedef struct _CEPK_STORE_ {
+  long maxsize, size;
+  long nhit, nmiss, ndrop;
+  int nh, n, stats;
+  CEPK_SENTRY **h;
+  CEPK_SENTRY *oldest, *newest;
+  LOCK lock;
+} CEPK_STORE;
+
+static CEPK_STORE pk_store;
+
+static unsigned long KeyCEPK(unsigned long h, int n, double *x) {
+  unsigned char *c;
+  int i;
+
+  c = (unsigned char *) x;
+  n *= sizeof(double);
+  for (i = 0; i < n; i++) {
+    h = (h ^ (unsigned long) c[i]) * 1099511628211UL;
+  }
+  return h;
+}
+
+/* everything besides the energies a CEPK depends on */
+static unsigned long ContextCEPK(void) {
+  double x[9];
+  unsigned long h;
+
+  x[0] = pw_type;
+  x[1] = egrid_type;
+  x[2] = MColl();
+  x[3] = pw_scratch.qr;
+  x[4] = pw_scratch.max_kl;
+  x[5] = pw_scratch.kl_cb;
+  x[6] = pw_scratch.nkl;
+  x[7] = GetResidualZ();
+  x[8] = pw_extrap.tol;
+  h = KeyCEPK(14695981039346656037UL, 9, x);
+  return KeyCEPK(h, pw_scratch.nkl, pw_scratch.kl);
+}
+
+static void SetKeyCEPK(CEPK_SENTRY *s, int ie, int k0, int k1, int k) {
+  s->k = k;
+  s->k0 = k0;
+  s->k1 = k1;
+  s->nte = n_tegrid;
+  s->e1 = egrid[ie];
+  memcpy(s->te, tegrid, sizeof(double)*n_tegrid);
+  s->ek0 = GetOrbital(k0)->energy;
+  s->ek1 = GetOrbital(k1)->energy;
+  s->cx = ContextCEPK();
+  s->key = KeyCEPK(s->cx, 1, &(s->e1));
+  s->key = KeyCEPK(s->key, n_tegrid, tegrid);
+  s->key = (s->key ^ (unsigned long) k) * 1099511628211UL;
+  s->key = (s->key ^ (unsigned long) k0) * 1099511628211UL;
+  s->key = (s->key ^ (unsigned long) k1) * 1099511628211UL;
+}
+
+static int SameKeyCEPK(CEPK_SENTRY *s, CEPK_SENTRY *t) {
+  if (s->key != t->key || s->cx != t->cx) return 0;
+  if (s->k != t->k || s->k0 != t->k0 || s->k1 != t->k1) return 0;
+  if (s->nte != t->nte || s->e1 != t->e1) return 0;
+  if (s->ek0 != t->ek0 || s->ek1 != t->ek1) return 0;
+  if (memcmp(s->te, t->te, sizeof(double)*s->nte)) return 0;
+  return 1;
+}
+
+static void CopyCEPK(CEPK *d, CEPK *s, int nte) {
+  int n;
+
+  n = s->nkappa;
+  d->nkappa = n;
+  d->kappa0 = malloc(sizeof(short)*n);
+  d->kappa1 = malloc(sizeof(short)*n);
+  d->pkd = malloc(sizeof(double)*n*nte);
+  d->pke = malloc(sizeof(double)*n*nte);
+  memcpy(d->kappa0, s->kappa0, sizeof(short)*n);
+  memcpy(d->kappa1, s->kappa1, sizeof(short)*n);
+  memcpy(d->pkd, s->pkd, sizeof(double)*n*nte);
+  memcpy(d->pke, s->pke, sizeof(double)*n*nte);
+}
+
+static void DropCEPKStore(void) {
+  CEPK_SENTRY *s, **p;
+
+  s = pk_store.oldest;
+  p = &(pk_store.h[s->key % pk_store.nh]);
+  while (*p != s) p = &((*p)->next);
+  *p = s->next;
+  pk_store.oldest = s->newer;
+  if (pk_store.oldest == NULL) pk_store.newest = NULL;
+  pk_store.size -= s->size;
+  pk_store.n--;
+  pk_store.ndrop++;
+  FreeExcitationPkData(&(s->pk));
+  free(s);
+}
+
+void FreeCEPKStore(void) {
+  while (pk_store.oldest) DropCEPKStore();
+  if (pk_store.h) {
+    free(pk_store.h);
+    pk_store.h = NULL;
+    DestroyLock(&pk_store.lock);
+  }
+  pk_store.nh = 0;
+  pk_store.size = 0;
+}
+
+void PrintCEPKStore(void) {
+  MPrintf(-1, "CEPK store: hit=%ld miss=%ld drop=%ld n=%d size=%.2fMB\n",
+	  pk_store.nhit, pk_store.nmiss, pk_store.ndrop, pk_store.n,
+	  pk_store.size/1048576.0);
+}
+
+/* fill pk from the store, 1 on a hit */
+static int LoadCEPKStore(CEPK *pk, int ie, int k0, int k1, int k) {
+  CEPK_SENTRY t, *s;
+  int r, nkl;
+
+  if (pk_store.maxsize <= 0 || pk_store.h == NULL) return 0;
+  SetKeyCEPK(&t, ie, k0, k1, k);
+  r = 0;
+  SetLock(&pk_store.lock);
+  s = pk_store.h[t.key % pk_store.nh];
+  while (s) {
+    if (SameKeyCEPK(s, &t)) break;
+    s = s->next;
+  }
+  if (s) {
+    CopyCEPK(pk, &(s->pk), s->nte);
+    nkl = s->pk.nkl;
+    pk_store.nhit++;
+    r = 1;
+  } else {
+    pk_store.nmiss++;
+  }
+  ReleaseLock(&pk_store.lock);
+  if (r) {
+#pragma omp flush
+    pk->nkl = nkl;
+  }
+  return r;
+}
+
+/* keep a copy of a newly computed pk */
+static void SaveCEPKStore(CEPK *pk, int ie, int k0, int k1, int k) {
+  CEPK_SENTRY *s, *t;
+  long size;
+  int i;
+
+  if (pk_store.maxsize <= 0 || pk_store.h == NULL) return;
+  /* FreeExcitationPkData frees nothing for nkl <= 0 */
+  if (pk->nkl <= 0) return;
+  size = sizeof(CEPK_SENTRY) +
+    pk->nkappa*(2*sizeof(short) + 2*sizeof(double)*n_tegrid);
+  if (size > pk_store.maxsize) return;
+  s = malloc(sizeof(CEPK_SENTRY));
+  SetKeyCEPK(s, ie, k0, k1, k);
+  s->size = size;
+  s->pk.nkl = pk->nkl;
+  CopyCEPK(&(s->pk), pk, n_tegrid);
+  s->newer = NULL;
+  SetLock(&pk_store.lock);
+  t = pk_store.h[s->key % pk_store.nh];
+  while (t) {
+    if (SameKeyCEPK(t, s)) break;
+    t = t->next;
+  }
+  if (t) {
+    ReleaseLock(&pk_store.lock);
+    FreeExcitationPkData(&(s->pk));
+    free(s);
+    return;
+  }
+  while (pk_store.oldest && pk_store.size + size > pk_store.maxsize) {
+    DropCEPKStore();
+  }
+  i = s->key % pk_store.nh;
+  s->next = pk_store.h[i];
+  pk_store.h[i] = s;
+  if (pk_store.newest) pk_store.newest->newer = s;
+  else pk_store.oldest = s;
+  pk_store.newest = s;
+  pk_store.size += size;
+  pk_store.n++;
+  ReleaseLock(&pk_store.lock);
+}
+
+static void InitCEPKStore(void) {
+  int i;
+
+  if (pk_store.maxsize <= 0 || pk_store.h) return;
+  pk_store.nh = CEPKSTORE_NH;
+  pk_store.h = malloc(sizeof(CEPK_SENTRY *)*pk_store.nh);
+  for (i = 0; i < pk_store.nh; i++) {
+    pk_store.h[i] = NULL;
+  }
+  pk_store.oldest = NULL;
+  pk_store.newest = NULL;
+  pk_store.n = 0;
+  pk_store.size = 0;
+  InitLock(&pk_store.lock);
+}
+
 int CERadialPk(CEPK **pk, int ie, int k0, int k1, int k, int trylock) {
   int type, ko2, i, m, t, q;
   int kf0, kf1, kpp0, kpp1, km0, km1;
@@ -467,6 +739,7 @@ int CERadialPk(CEPK **pk, int ie, int k0, int k1, int k, int trylock) {
   int nkappa, noex[MAXNTE];
   short *kappa0, *kappa1;
   double *pkd, *pke;
+  double xd[MAXNKL][MAXNTE], xt[MAXNKL][MAXNTE];
 
 #ifdef PERFORM_STATISTICS
   clock_t start, stop;
@@ -509,6 +782,10 @@ int CERadialPk(CEPK **pk, int ie, int k0, int k1, int k, int trylock) {
     if (locked) ReleaseLock(lock);
     return type;
   }
+  if (LoadCEPKStore(*pk, ie, k0, k1, k)) {
+    if (locked) ReleaseLock(lock);
+    return type;
+  }
 
   nkappa = (MAXNKL)*(GetMaxRank()+1)*4;
   kappa0 = (short *) malloc(sizeof(short)*nkappa);
@@ -552,8 +829,11 @@ int CERadialPk(CEPK **pk, int ie, int k0, int k1, int k, int trylock) {
   for (t = 0; t < pw_scratch.nkl; t++) {
     kl0 = pw_scratch.kl[t];
     if (pw_scratch.kl[t] > kl_max) break;
+    if (pw_extrap.tol > 0 && ConvergedCEPW(t, xd, xt)) break;
     kl0p = 2*kl0;
     for (i = 0; i < n_tegrid; i++) {
+      xd[t][i] = 0.0;
+      xt[t][i] = 0.0;
       if (noex[i] == 0) {
 	if (1+tex[i] != 1) {
 	  a = fabs(1.0 - tdi[i]/tex[i]);
@@ -628,6 +908,8 @@ int CERadialPk(CEPK **pk, int ie, int k0, int k1, int k, int trylock) {
 	      }
 	      tdi[i] += sd*sd;
 	      tex[i] += (sd+se)*(sd+se);
+	      xd[t][i] += sd*sd;
+	      xt[t][i] += (sd+se)*(sd+se);
 	    } else {
 	      se = 0.0;
 	      if (kl1 >= pw_scratch.qr &&
@@ -641,6 +923,8 @@ int CERadialPk(CEPK **pk, int ie, int k0, int k1, int k, int trylock) {
 		  break;
 		}
 	      }
+	      xd[t][i] += sd*sd;
+	      xt[t][i] += sd*sd;
 	    }
 	    pkd[q] = sd;
 	    pke[q] = se;
@@ -667,6 +951,22 @@ int CERadialPk(CEPK **pk, int ie, int k0, int k1, int k, int trylock) {
   (*pk)->pkd = ReallocNew(pkd, sizeof(double)*q);
   (*pk)->pke = ReallocNew(pke, sizeof(double)*q);  
   (*pk)->nkl = t;
+  SaveCEPKStore(*pk, ie, k0, k1, k);
+  if (pw_extrap.stats) {
+    for (i = t; i < pw_scratch.nkl; i++) {
+      if (pw_scratch.kl[i] > kl_max) break;
+    }
+#pragma omp atomic
+    pw_extrap.npk++;
+#pragma omp atomic
+    pw_extrap.nkl += t;
+    if (i > t) {
+#pragma omp atomic
+      pw_extrap.nstop++;
+#pragma omp atomic
+      pw_extrap.nsaved += i-t;
+    }
+  }
   
   if (locked) ReleaseLock(lock);
 #pragma omp flush
@@ -3113,6 +3413,7 @@ int SaveExcitation(int nlow, int *low, int nup, int *up, int msub, char *fn) {
   fhdr.type = DB_CE;
   strcpy(fhdr.symbol, GetAtomicSymbol());
   fhdr.atom = GetAtomicNumber();
+  InitCEPKStore();
   f = OpenFile(fn, &fhdr);
   for (isub = 1; isub < subte.dim; isub++) {
     e1 = *((double *) ArrayGet(&subte, isub));
@@ -3331,6 +3632,8 @@ int SaveExcitation(int nlow, int *low, int nup, int *up, int msub, char *fn) {
   }
   
   ReinitExcitation(1);
+  if (pk_store.stats) PrintCEPKStore();
+  if (pw_extrap.stats) PrintCEPWExtrap();
   //FreeCECache(0);
   ArrayFreeLock(&subte, NULL);
   if (alev) free(alev);
@@ -3490,6 +3793,7 @@ int SaveExcitationEB(int nlow0, int *low0, int nup0, int *up0, char *fn) {
   fhdr.type = DB_CEF;
   strcpy(fhdr.symbol, GetAtomicSymbol());
   fhdr.atom = GetAtomicNumber();
+  InitCEPKStore();
   f = OpenFile(fn, &fhdr);
   for (isub = 1; isub < subte.dim; isub++) {
     e1 = *((double *) ArrayGet(&subte, isub));
@@ -3749,6 +4053,7 @@ int SaveExcitationEBD(int nlow0, int *low0, int nup0, int *up0, char *fn) {
   fhdr.type = DB_CEMF;
   strcpy(fhdr.symbol, GetAtomicSymbol());
   fhdr.atom = GetAtomicNumber();
+  InitCEPKStore();
   f = OpenFile(fn, &fhdr);
   for (isub = 1; isub < subte.dim; isub++) {
     e1 = *((double *) ArrayGet(&subte, isub));
@@ -3923,6 +4228,7 @@ int InitExcitation(void) {
   ndim = 3;
   pk_array = (MULTI *) malloc(sizeof(MULTI));
   MultiInit(pk_array, sizeof(CEPK), ndim, blocks1, "pk_array");
+  pk_store.maxsize = MAXCEPKSTORE;
 
   ndim = 5;
   qk_array = (MULTI *) malloc(sizeof(MULTI));
@@ -3953,6 +4259,7 @@ int ReinitExcitation(int m) {
   
   if (m < 0) return 0;
   FreeExcitationQk();  
+  if (m == 0) FreeCEPKStore();
   if (fpw) {
     fclose(fpw);
     fpw = NULL;
@@ -3975,4 +4282,21 @@ void SetOptionExcitation(char *s, char *sp, int ip, double dp) {
     pw_scratch.min_kl = ip;
     return;
   }
+  if (strcmp("excitation:pk_store", s) == 0) {
+    FreeCEPKStore();
+    pk_store.maxsize = ((long) ip)*1048576L;
+    return;
+  }
+  if (strcmp("excitation:pk_store_stats", s) == 0) {
+    pk_store.stats = ip;
+    return;
+  }
+  if (strcmp("excitation:pw_extrap", s) == 0) {
+    pw_extrap.tol = dp;
+    return;
+  }
+  if (strcmp("excitation:pw_extrap_stats", s) == 0) {
+    pw_extrap.stats = ip;
+    return;
+  }
 }
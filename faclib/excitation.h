@@ -86,6 +86,9 @@ void FreeCECache(int m);
 void FreeCEQKK(CEQKK *qk, int m);
 void FreeCEPKK(CEPKK *pk);
 int FreeExcitationQk(void);
+void FreeCEPKStore(void);
+void PrintCEPKStore(void);
+void PrintCEPWExtrap(void);
 int InitExcitation(void);
 int ReinitExcitation(int m);
 int SetCETEGrid(int n, double emin, double emax);
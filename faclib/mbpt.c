@@ -34,6 +34,14 @@ static int mbpt_extra = 0;
 static int mbpt_rand = 0;
 static int mbpt_msort = 0;
 static double mbpt_asort = 10.0;
+static int mbpt_cost = 1;
+static double mbpt_ckp = 0;
+/* slater tensor memory in MB, shared by the openmp threads */
+static double mbpt_stensor = 256.0;
+static int mbpt_restart = 0;
+/* mbpt:shard, under MPI each rank owns the symmetries it diagonalized */
+static int mbpt_shard0 = 0;
+static int mbpt_shard = 0;
 static int mbpt_prepyk = 0;
 static int mbpt_nbreit = -1;
 static double mbpt_warn = 0.05;
@@ -92,13 +100,29 @@ static struct {
   int *jp;
   IDXARY ibs;
   int *sa, *ma;
-  double *sd1a, *sd2a, *c12a;
+  double *sd1a, *sd2a, *c12a, *ca;
+  double *wa;
+  size_t nwa;
 } mbptjp = {0, NULL};
 
 static int mbpt_nmk0, mbpt_nmk1;
 static ARRAY *mbpt_csary;
+/*
+** the slater integrals of the 2-virtual sums. for each pair of bound
+** orbitals in mbpt_ibnd and side, a dense block over the virtual pairs
+** of the mbpt basis mbpt_ibas, with the multipoles of each virtual
+** pair stored contiguously. filled as the sums first need them. each
+** thread may use its share of mbpt_stensor in max.
+*/
+#define STNA 1E300
+static IDXARY mbpt_ibas, mbpt_ibnd;
+static struct {
+  int n, nb;
+  double **t;
+  double size, max;
+} mbpt_stn = {0, 0, NULL, 0.0, 0.0};
 
-#pragma omp threadprivate(mbpt_cs, mbpt_cfg, mbpt_bas0, mbpt_bas0s, mbpt_bas0d, mbpt_bas1, mbpt_ibas0, mbpt_ibas1, mbptjp, mbpt_cca)
+#pragma omp threadprivate(mbpt_cs, mbpt_cfg, mbpt_bas0, mbpt_bas0s, mbpt_bas0d, mbpt_bas1, mbpt_ibas0, mbpt_ibas1, mbptjp, mbpt_cca, mbpt_stn)
   
 static TR_OPT mbpt_tr;
 
@@ -109,6 +133,11 @@ void PrintMBPTOptions(void) {
   printf("rand=%d\n", mbpt_rand);
   printf("msort=%d\n", mbpt_msort);
   printf("asort=%g\n", mbpt_asort);
+  printf("cost=%d\n", mbpt_cost);
+  printf("ckp=%g\n", mbpt_ckp);
+  printf("stensor=%g\n", mbpt_stensor);
+  printf("restart=%d\n", mbpt_restart);
+  printf("shard=%d\n", mbpt_shard0);
   printf("prepyk=%d\n", mbpt_prepyk);
   printf("nbreit=%d\n", mbpt_nbreit);
   printf("warn=%g\n", mbpt_warn);
@@ -149,6 +178,8 @@ void PrintMBPTOptions(void) {
 }
 
 int SkipMPIM(int s) {
+  /* a sharded rank does all work of its own symmetries */
+  if (mbpt_shard) return 0;
   if (s == mbpt_omp) {
     return SkipMPI();
   } else {
@@ -334,6 +365,26 @@ void SetOptionMBPT(char *s, char *sp, int ip, double dp) {
     mbpt_asort = dp;
     return;
   }  
+  if (0 == strcmp(s, "mbpt:cost")) {
+    mbpt_cost = ip;
+    return;
+  }  
+  if (0 == strcmp(s, "mbpt:ckp")) {
+    mbpt_ckp = dp;
+    return;
+  }  
+  if (0 == strcmp(s, "mbpt:stensor")) {
+    mbpt_stensor = dp;
+    return;
+  }  
+  if (0 == strcmp(s, "mbpt:restart")) {
+    mbpt_restart = ip;
+    return;
+  }  
+  if (0 == strcmp(s, "mbpt:shard")) {
+    mbpt_shard0 = ip;
+    return;
+  }  
   if (0 == strcmp(s, "mbpt:n3")) {
     mbpt_n3 = ip;
     return;
@@ -1890,6 +1941,93 @@ void UnpackSymStateMBPT(MBPT_EFF **meff, int ms, int *s, int *m) {
 
 #define MKK 20
 
+static void InitSlaterTensorMBPT(void) {
+  int i, k;
+
+  mbpt_stn.n = 0;
+  mbpt_stn.nb = 0;
+  mbpt_stn.t = NULL;
+  mbpt_stn.size = 0.0;
+  if (mbpt_stensor <= 0 || mbpt_ibas.n <= 0 || mbpt_ibnd.n <= 0) return;
+  mbpt_stn.max = mbpt_stensor*1E6;
+#if USE_MPI == 2
+  if (NProcMPI() > 1) mbpt_stn.max /= NProcMPI();
+#endif
+  mbpt_stn.n = mbpt_ibas.n;
+  mbpt_stn.nb = mbpt_ibnd.n;
+  k = 2*mbpt_stn.nb*mbpt_stn.nb;
+  mbpt_stn.t = malloc(sizeof(double *)*k);
+  for (i = 0; i < k; i++) mbpt_stn.t[i] = NULL;
+}
+
+static void FreeSlaterTensorMBPT(void) {
+  int i, k;
+
+  if (mbpt_stn.t == NULL) return;
+  k = 2*mbpt_stn.nb*mbpt_stn.nb;
+  for (i = 0; i < k; i++) {
+    if (mbpt_stn.t[i]) free(mbpt_stn.t[i]);
+  }
+  free(mbpt_stn.t);
+  mbpt_stn.t = NULL;
+  mbpt_stn.n = 0;
+}
+
+/*
+** the block of the bound pair k0, k1 on side s, s=0 for <k0 k1|v v>,
+** s=1 for <v v|k0 k1>. the number of multipoles of any virtual pair
+** is bounded by min(j0, j1)+1, which is the stride of the block.
+** returns NULL if the block does not fit in the memory limit.
+*/
+static double *SlaterTensorMBPT(int k0, int k1, int s, int *nk) {
+  int i, x, y, j0, j1;
+  size_t m;
+  double *t;
+
+  if (mbpt_stn.t == NULL) return NULL;
+  x = IdxGet(&mbpt_ibnd, k0);
+  y = IdxGet(&mbpt_ibnd, k1);
+  if (x < 0 || y < 0) return NULL;
+  j0 = GetJFromKappa(GetOrbital(k0)->kappa);
+  j1 = GetJFromKappa(GetOrbital(k1)->kappa);
+  *nk = Min(j0, j1) + 1;
+  i = 2*(x*mbpt_stn.nb + y) + s;
+  if (mbpt_stn.t[i]) return mbpt_stn.t[i];
+  m = ((size_t) mbpt_stn.n)*mbpt_stn.n*(*nk);
+  if (mbpt_stn.size + m*sizeof(double) > mbpt_stn.max) return NULL;
+  t = malloc(sizeof(double)*m);
+  if (t == NULL) return NULL;
+  for (; m > 0; m--) t[m-1] = STNA;
+  mbpt_stn.size += ((size_t) mbpt_stn.n)*mbpt_stn.n*(*nk)*sizeof(double);
+  mbpt_stn.t[i] = t;
+  return t;
+}
+
+/*
+** n arrays of length m for the angular coefficients of the DeltaH
+** sums, carved from a per-thread work space that only grows.
+*/
+static void WorkSpaceMBPT(int n, size_t m, double **a) {
+  int i;
+  size_t k;
+
+  k = n*m;
+  if (k > mbptjp.nwa) {
+    if (mbptjp.wa) free(mbptjp.wa);
+    mbptjp.wa = malloc(sizeof(double)*k);
+    mbptjp.nwa = k;
+  }
+  for (i = 0; i < n; i++) {
+    a[i] = mbptjp.wa + i*m;
+  }
+}
+
+static void FreeWorkSpaceMBPT(void) {
+  if (mbptjp.wa) free(mbptjp.wa);
+  mbptjp.wa = NULL;
+  mbptjp.nwa = 0;
+}
+
 void FixTotalJ(int ns, SHELL_STATE *st, SHELL *s, CONFIG *c, int m) {
   SHELL_STATE *st0;
   int i, j;
@@ -1975,7 +2113,7 @@ void H22Term(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1,
 	     SHELL_STATE *sbra, SHELL_STATE *sket,
 	     int mst, int *bst, int *kst,
 	     INTERACT_SHELL *s, int ph, int *ks1, int *ks2,
-	     FORMULA *fm, double **a, int i0) {
+	     FORMULA *fm, double **a, int i0, double *t1, double *t2) {
   int m, kk1, kk2, kmin1, kmin2, kmax1, kmax2;
   int mkk1, mkk2, mkk, k, i1, ng, i1g;
   int q0, q1, m0, m1, ms0, ms1, s0, s1;
@@ -2076,8 +2214,14 @@ void H22Term(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1,
       if (m == 1) break;
     }
     if (m) {
-      SlaterTotal(&sd1, &se1, NULL, ks1, kk1, 0);
-      a1[mkk1] = sd1 + se1;
+      /* t1, t2 are the slater tensor entries, by (kk-kmin)/2 */
+      if (t1 && t1[(kk1-kmin1)/2] < STNA) {
+	a1[mkk1] = t1[(kk1-kmin1)/2];
+      } else {
+	SlaterTotal(&sd1, &se1, NULL, ks1, kk1, 0);
+	a1[mkk1] = sd1 + se1;
+	if (t1) t1[(kk1-kmin1)/2] = a1[mkk1];
+      }
     } else {
       a1[mkk1] = 0.0;
     }
@@ -2100,8 +2244,13 @@ void H22Term(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1,
       if (m == 1) break;
     }
     if (m) {
-      SlaterTotal(&sd2, &se2, NULL, ks2, kk2, 0);
-      a2[mkk2] = sd2 + se2;
+      if (t2 && t2[(kk2-kmin2)/2] < STNA) {
+	a2[mkk2] = t2[(kk2-kmin2)/2];
+      } else {
+	SlaterTotal(&sd2, &se2, NULL, ks2, kk2, 0);
+	a2[mkk2] = sd2 + se2;
+	if (t2) t2[(kk2-kmin2)/2] = a2[mkk2];
+      }
     } else {
       a2[mkk2] = 0.0;
     }
@@ -2153,37 +2302,64 @@ void H22Term(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1,
   d2 -= GetOrbital(ks1[2])->energy + GetOrbital(ks1[3])->energy;
   */
   int *sp, *mp;
-  double *sd1p, *sd2p, *c12p;
+  double *sd1p, *sd2p, *c12p, *cp;
   int warned = 0, ignored = 0;
   sd1p = mbptjp.sd1a;
   sd2p = mbptjp.sd2a;
   c12p = mbptjp.c12a;
+  cp = mbptjp.ca;
   sp = mbptjp.sa;
   mp = mbptjp.ma;
+  /*
+  ** the radial and phase factors of each multipole pair are
+  ** independent of the states, fold them into one weight and
+  ** accumulate over all states at once. the energy denominators
+  ** are common to all states, invert them once.
+  */
+  double wk[MKK*MKK];
+  int iwk[MKK*MKK], nwk = 0, i;
+  for (kk1 = kmin1; kk1 <= kmax1; kk1 += 2) {
+    mkk1 = kk1/2;
+    if (fabs(a1[mkk1]) < EPS30) continue;
+    mkk = mkk1*MKK;
+    for (kk2 = kmin2; kk2 <= kmax2; kk2 += 2) {
+      mkk2 = kk2/2;
+      if (fabs(a2[mkk2]) < EPS30) continue;
+      y = a1[mkk1]*a2[mkk2]/sqrt((kk1+1.0)*(kk2+1.0));
+      if (IsOdd((kk1+kk2)/2)) y = -y;
+      iwk[nwk] = mkk+mkk2;
+      wk[nwk] = y;
+      nwk++;
+    }
+  }
   for (k = 0; k < mst; k++) {
+    cp[k] = 0.0;
+  }
+  for (i = 0; i < nwk; i++) {
+    double *ak = a[iwk[i]];
+    y = wk[i];
+    for (k = 0; k < mst; k++) {
+      cp[k] += y*ak[k];
+    }
+  }
+  double id1 = 1.0/d1;
+  double id2 = 1.0/d2;
+  double id12 = id1*id2;
+  for (k = 0; k < mst; k++) {
+    sd1p[k] = cp[k]*id1;
+    sd2p[k] = cp[k]*id2;
+    c12p[k] = cp[k]*id12;
+  }
+  for (k = 0; k < mst; k++) {
+    sp[k] = -1;
+    c = cp[k];
+    if (fabs(c) < EPS30) continue;
     q0 = bst[k];
     q1 = kst[k];
     ms0 = c0->symstate[q0];
     UnpackSymStateMBPT(meff, ms0, &s0, &m0);
     ms1 = c1->symstate[q1];
     UnpackSymStateMBPT(meff, ms1, &s1, &m1);
-    sp[k] = -1;
-    c = 0.0;
-    for (kk1 = kmin1; kk1 <= kmax1; kk1 += 2) {
-      mkk1 = kk1/2;
-      mkk = mkk1*MKK;
-      for (kk2 = kmin2; kk2 <= kmax2; kk2 += 2) {
-	mkk2 = kk2/2;
-	y = a[mkk+mkk2][k];
-	if (fabs(y) < EPS30) continue;
-	if (fabs(a1[mkk1]) < EPS30) continue;
-	if (fabs(a2[mkk2]) < EPS30) continue;	  
-	y /= sqrt((kk1+1.0)*(kk2+1.0));
-	if (IsOdd((kk1+kk2)/2)) y = -y;      
-	c += y*a1[mkk1]*a2[mkk2];
-      }
-    }
-    if (fabs(c) < EPS30) continue;
     if (m1 > m0) {
       m = m1*(m1+1)/2 + m0;
     } else {
@@ -2191,14 +2367,11 @@ void H22Term(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1,
     }
     mp[k] = m;
     sp[k] = s0;
-    double c12 = c/(d1*d2);
-    sd1 = c/d1;
-    sd2 = c/d2;
-    sd1p[k] = sd1;
-    sd2p[k] = sd2;
-    c12p[k] = c12;
-    double sd1w = sqrt(fabs(sd1/d1));
-    double sd2w = sqrt(fabs(sd2/d2));
+    double c12 = c12p[k];
+    sd1 = sd1p[k];
+    sd2 = sd2p[k];
+    double sd1w = sqrt(fabs(sd1*id1));
+    double sd2w = sqrt(fabs(sd2*id2));
     double sd1s = sd1w;
     double sd2s = sd2w;
     if (isnan(c12)) {
@@ -2435,37 +2608,57 @@ void H12Term(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1,
     if (IsOdd(kk2)) yk[kk2] = -yk[kk2];
   }
   int *sp, *mp;
-  double *sd1p, *sd2p, *c12p;
+  double *sd1p, *sd2p, *c12p, *cp;
   int warned = 0, ignored = 0;
   sd1p = mbptjp.sd1a;
   sd2p = mbptjp.sd2a;
   c12p = mbptjp.c12a;
+  cp = mbptjp.ca;
   sp = mbptjp.sa;
   mp = mbptjp.ma;
+  /* accumulate over all states at once, see H22Term */
+  for (k = 0; k < mst; k++) {
+    cp[k] = 0.0;
+  }
+  for (kk = kmin; kk <= kmax; kk += 2) {
+    kk2 = kk/2;
+    if (yk[kk2] == 0) continue;
+    double *ak = a[kk2];
+    y = yk[kk2]/sqrt(kk+1.0);
+    for (k = 0; k < mst; k++) {
+      cp[k] += y*ak[k];
+    }
+  }
+  r1 = 0.0;
+  for (k = 0; k < mst; k++) {
+    if (fabs(cp[k]) >= EPS30) break;
+  }
+  if (k < mst) {
+    ResidualPotential(&r1, k0, k1);
+    r1 += QED1E(k0, k1);
+    r1 *= sqrt(s[0].j+1.0);
+    /* minus sign is from the definition of Z^k */
+    r1 = -r1;
+  }
+  double id1 = 1.0/d1;
+  double id2 = 1.0/d2;
+  double id12 = id1*id2;
+  for (k = 0; k < mst; k++) {
+    c = cp[k]*r1;
+    sd1p[k] = c*id1;
+    sd2p[k] = c*id2;
+    c12p[k] = c*id12;
+  }
   for (k = 0; k < mst; k++) {
     sp[k] = -1;
+    if (fabs(cp[k]) < EPS30) continue;
+    c = cp[k]*r1;
     q0 = bst[k];
     q1 = kst[k];
     ms0 = c0->symstate[q0];
     UnpackSymStateMBPT(meff, ms0, &s0, &m0);
     ms1 = c1->symstate[q1];
     UnpackSymStateMBPT(meff, ms1, &s1, &m1);
-    c = 0.0;
-    for (kk = kmin; kk <= kmax; kk += 2) {
-      kk2 = kk/2;
-      if (a[kk2][k] == 0) continue;
-      if (yk[kk2] == 0) continue;
-      y = a[kk2][k];
-      y /= sqrt(kk+1.0);
-      c += y*yk[kk2];
-    }
-    if (fabs(c) < EPS30) continue;
-    ResidualPotential(&r1, k0, k1);
-    r1 += QED1E(k0, k1);
-    r1 *= sqrt(s[0].j+1.0);
-    c *= r1;
-    /* minus sign is from the definition of Z^k */
-    c = -c;    
     if (m0 <= m1) {
       m = m1*(m1+1)/2 + m0;
       mp[k] = -m;
@@ -2474,14 +2667,11 @@ void H12Term(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1,
       mp[k] = m;
     }
     sp[k] = s0;
-    double c12 = c/(d1*d2);
-    sd = c/d1;
-    se = c/d2;
-    sd1p[k] = sd;
-    sd2p[k] = se;
-    c12p[k] = c12;
-    double sd1w = sqrt(fabs(sd/d1));
-    double sd2w = sqrt(fabs(se/d2));
+    double c12 = c12p[k];
+    sd = sd1p[k];
+    se = sd2p[k];
+    double sd1w = sqrt(fabs(sd*id1));
+    double sd2w = sqrt(fabs(se*id2));
     double sd1s = sd1w;
     double sd2s = sd2w;//c0->cth>0?c0->cth/fabs(d2):0;
     if (isnan(c12)) {
@@ -3268,7 +3458,8 @@ void DeltaH22M2Loop(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1, int ns,
 		    IDXARY *ib0, IDXARY *ib1, IDXARY *ing, 
 		    IDXARY *ing2, int ph,
 		    int ia, int ib, int ic, int id, int ik, int im,
-		    FORMULA *fm, double **a) {
+		    FORMULA *fm, double **a,
+		    double *t1, int nk1, double *t2, int nk2) {
   double c, d1, d2;
   int ip, iq;
   int ks1[4], ks2[4];
@@ -3336,8 +3527,21 @@ void DeltaH22M2Loop(MBPT_EFF **meff, CONFIG *c0, CONFIG *c1, int ns,
   } else {
     i = -(i1+1);
   }
+  if (t1 || t2) {
+    /* the virtual pair (ik, im) in the slater tensor */
+    m1 = IdxGet(&mbpt_ibas, ks1[2]);
+    m2 = IdxGet(&mbpt_ibas, ks1[3]);
+    if (m1 < 0 || m2 < 0) {
+      t1 = NULL;
+      t2 = NULL;
+    } else {
+      m1 = m1*mbpt_stn.n + m2;
+      if (t1) t1 += m1*nk1;
+      if (t2) t2 += m1*nk2;
+    }
+  }
   H22Term(meff, c0, c1, ns, bra, ket, sbra, sket, mst, bst, kst,
-	  s, ph, ks1, ks2, fm, a, i);
+	  s, ph, ks1, ks2, fm, a, i, t1, t2);
 }
     
 void DeltaH22M2(MBPT_EFF **meff, int ns,
@@ -3348,18 +3552,16 @@ void DeltaH22M2(MBPT_EFF **meff, int ns,
 		IDXARY *ib1, IDXARY *ing, 
 		IDXARY *ing2, int nc, CONFIG **cs) {
   int ia, ib, ic, id, ik, im;
-  int m1, m2, i, k, j1, j2;
+  int m1, m2, k, j1, j2;
   int op[4], om[4], ph;
-  double *a[MKK*MKK];
+  double *a[MKK*MKK], *t1, *t2;
+  int nk1, nk2;
   ORBITAL *o;
   FORMULA fm;
 
   fm.ns = -1;
   if (ib1->n <= 0) return;
-  k = MKK*MKK;
-  for (i = 0; i < k; i++) {
-    a[i] = malloc(sizeof(double)*mst);
-  }
+  WorkSpaceMBPT(MKK*MKK, mst, a);
   fm.js[0] = 0;
   int nmb, nmk;
   for (ia = 0; ia < ib0->n; ia++) {    
@@ -3370,6 +3572,7 @@ void DeltaH22M2(MBPT_EFF **meff, int ns,
 	nmb = Min(ib0s[ia], ib0s[ib]);
       }
       if (nmb <= 0) continue;
+      t1 = NULL;
       for (ic = 0; ic < ib0->n; ic++) {
 	for (id = 0; id <= ic; id++) {
 	  if (ic == id) {
@@ -3392,6 +3595,10 @@ void DeltaH22M2(MBPT_EFF **meff, int ns,
 	  om[1] = id;
 	  ph = CheckInteraction(ns-2, bra+2, ket+2, 2, op, 2, om);
 	  if (ph < 0) continue;	  
+	  if (t1 == NULL) {
+	    t1 = SlaterTensorMBPT(ib0->d[ia], ib0->d[ib], 0, &nk1);
+	  }
+	  t2 = SlaterTensorMBPT(ib0->d[ic], ib0->d[id], 1, &nk2);
 	  if (ing2->m0 == 0) {
 	    fm.j1 = -1;
 	    fm.j2 = -1;
@@ -3415,7 +3622,8 @@ void DeltaH22M2(MBPT_EFF **meff, int ns,
 		DeltaH22M2Loop(meff, c0, c1, ns, bra, ket, sbra, sket, 
 			       mst, bst, kst,
 			       ib0, ib1, ing, ing2, ph,
-			       ia, ib, ic, id, ik, im, &fm, a);
+			       ia, ib, ic, id, ik, im, &fm, a,
+			       t1, nk1, t2, nk2);
 	      }
 	    }
 	  }	  
@@ -3447,7 +3655,8 @@ void DeltaH22M2(MBPT_EFF **meff, int ns,
 		  DeltaH22M2Loop(meff, c0, c1, ns, bra, ket, sbra, sket, 
 				 mst, bst, kst,
 				 ib0, ib1, ing, ing2, ph,
-				 ia, ib, ic, id, ik, im, &fm, a);
+				 ia, ib, ic, id, ik, im, &fm, a,
+				 t1, nk1, t2, nk2);
 		}
 	      }	    
 	    }
@@ -3456,10 +3665,6 @@ void DeltaH22M2(MBPT_EFF **meff, int ns,
       }
     }
   }
-  k = MKK*MKK;
-  for (i = 0; i < k; i++) {
-    free(a[i]);
-  }
 }
 
 void DeltaH22M1(MBPT_EFF **meff, int ns,
@@ -3479,10 +3684,7 @@ void DeltaH22M1(MBPT_EFF **meff, int ns,
   fm.ns = -1;
   fm.js[0] = 0;
   if (ib1->n <= 0) return;
-  k = MKK*MKK;
-  for (i = 0; i < k; i++) {
-    a[i] = malloc(sizeof(double)*mst);
-  }
+  WorkSpaceMBPT(MKK*MKK, mst, a);
   int nmb, nmk;
   for (ia = 0; ia < ib0->n; ia++) {
     for (ib = 0; ib <= ia; ib++) {
@@ -3597,7 +3799,7 @@ void DeltaH22M1(MBPT_EFF **meff, int ns,
 		  if (i1 < 0) continue;
 		  H22Term(meff, c0, c1, ns, bra, ket, sbra, sket, 
 			  mst, bst, kst, s, ph, 
-			  ks1, ks2, &fm, a, -(i1+1));
+			  ks1, ks2, &fm, a, -(i1+1), NULL, NULL);
 		}
 	      }
 	    }
@@ -3606,10 +3808,6 @@ void DeltaH22M1(MBPT_EFF **meff, int ns,
       }
     }
   }
-  k = MKK*MKK;
-  for (i = 0; i < k; i++) {
-    free(a[i]);
-  }
 }
 
 void DeltaH22M0(MBPT_EFF **meff, int ns,
@@ -3628,10 +3826,7 @@ void DeltaH22M0(MBPT_EFF **meff, int ns,
   i1 = bra[0].n;
   i1 = IdxGetN1(ing, i1);
   if (i1 < 0) return;
-  k = MKK*MKK;
-  for (i = 0; i < k; i++) {
-    a[i] = malloc(sizeof(double)*mst);
-  }
+  WorkSpaceMBPT(MKK*MKK, mst, a);
   fm.js[0] = 0;
   int nmb, nmk;
   for (ia = 0; ia < ib0->n; ia++) {
@@ -3765,7 +3960,7 @@ void DeltaH22M0(MBPT_EFF **meff, int ns,
 		  if (SkipMPIM(1)) continue;
 		  H22Term(meff, c0, c1, ns, bra, ket, sbra, sket, 
 			  mst, bst, kst, s, ph,
-			  ks1, ks2, &fm, a, -(i1+1));
+			  ks1, ks2, &fm, a, -(i1+1), NULL, NULL);
 		}
 	      }
 	    }
@@ -3774,10 +3969,6 @@ void DeltaH22M0(MBPT_EFF **meff, int ns,
       }
     }
   }
-  k = MKK*MKK;
-  for (i = 0; i < k; i++) {
-    free(a[i]);
-  }
 }
 
 void DeltaH12M1(void *mptr, int ns,
@@ -3796,14 +3987,7 @@ void DeltaH12M1(void *mptr, int ns,
   fm.ns = -1;
   fm.js[0] = 0;
   if (ib1->n <= 0) return;
-  k = MKK;
-  for (i = 0; i < k; i++) {
-    if (mode == 0) {
-      a[i] = malloc(sizeof(double)*mst);
-    } else {
-      a[i] = malloc(sizeof(double)*mst*mbpt_tr.nktr);
-    }
-  }
+  WorkSpaceMBPT(MKK, mode==0?mst:mst*mbpt_tr.nktr, a);
   int nmb, nmk;
   for (ia = 0; ia < ib0->n; ia++) {
     if (bra[ia+1].nq == 0) continue;
@@ -3903,10 +4087,6 @@ void DeltaH12M1(void *mptr, int ns,
       }
     }
   }
-  k = MKK;
-  for (i = 0; i < k; i++) {
-    free(a[i]);
-  }
 }
 
 void DeltaH12M0(void *mptr, int ns,
@@ -3925,14 +4105,7 @@ void DeltaH12M0(void *mptr, int ns,
   i1 = bra[0].n;
   i1 = IdxGetN1(ing, i1);
   if (i1 < 0) return;
-  k = MKK;
-  for (i = 0; i < k; i++) {
-    if (mode == 0) {
-      a[i] = malloc(sizeof(double)*mst);
-    } else {
-      a[i] = malloc(sizeof(double)*mst*mbpt_tr.nktr);
-    }
-  }
+  WorkSpaceMBPT(MKK, mode==0?mst:mst*mbpt_tr.nktr, a);
   fm.js[0] = 0;
   int nmb, nmk;
   for (ia = 0; ia < ib0->n; ia++) {
@@ -4036,10 +4209,6 @@ void DeltaH12M0(void *mptr, int ns,
       }
     }
   }
-  k = MKK;
-  for (i = 0; i < k; i++) {
-    free(a[i]);
-  }
 }
 
 void DeltaH11M1(void *mptr, int ns, 
@@ -4057,11 +4226,7 @@ void DeltaH11M1(void *mptr, int ns,
   fm.ns = -1;
   fm.js[0] = 0;
   if (ib1->n <= 0) return;
-  if (mode == 0) {
-    a = malloc(sizeof(double)*mst);
-  } else {
-    a = malloc(sizeof(double)*mst*mbpt_tr.nktr);
-  }
+  WorkSpaceMBPT(1, mode==0?mst:mst*mbpt_tr.nktr, &a);
   int nmb, nmk;
   for (ia = 0; ia < ib0->n; ia++) {
     if (bra[ia+1].nq == 0) continue;
@@ -4139,7 +4304,6 @@ void DeltaH11M1(void *mptr, int ns,
       }
     }
   }
-  free(a);
 }
   
 void DeltaH11M0(void *mptr, int ns, 
@@ -4159,11 +4323,7 @@ void DeltaH11M0(void *mptr, int ns,
   i1 = bra[0].n;
   i1 = IdxGetN1(ing, i1);
   if (i1 < 0) return;
-  if (mode == 0) {
-    a = malloc(sizeof(double)*mst);
-  } else {
-    a = malloc(sizeof(double)*mst*mbpt_tr.nktr);
-  }
+  WorkSpaceMBPT(1, mode==0?mst:mst*mbpt_tr.nktr, &a);
   fm.js[0] = 0;
   int nmb, nmk;
   for (ia = 0; ia < ib0->n; ia++) {
@@ -4251,7 +4411,6 @@ void DeltaH11M0(void *mptr, int ns,
       }
     }
   }
-  free(a);
 }
   
 void FreeEffMBPT(MBPT_EFF **meff) {
@@ -4262,6 +4421,7 @@ void FreeEffMBPT(MBPT_EFF **meff) {
     if (meff[i]->nbasis > 0) {
       k = meff[i]->nbasis;
       k = k*(k+1)/2;
+      if (meff[i]->hab1 == NULL) k = 0;
       for (m = 0; m < k; m++) {
 	if (meff[i]->hab1[m]) {
 	  free(meff[i]->hab1[m]);
@@ -4415,10 +4575,13 @@ int GetJpList(int n, int *bas, int *jp) {
 }
 
 int GetICP(int nt, CONFIG_PAIR *cp, int ncp, int icp, int *i0, int *i1) {
-  int i, m, mb, mb1, mr, k;
+  int i, k, m, mb, mb1, mr;
+  double c, cb, cb1;
   m = 0;
+  c = 0;
   for (i = 0; i < nt; i++) {
     m += cp[i].m;
+    c += cp[i].c;
   }
   if (ncp <= 0) {
     *i0 = 0;
@@ -4426,35 +4589,461 @@ int GetICP(int nt, CONFIG_PAIR *cp, int ncp, int icp, int *i0, int *i1) {
     return m;
   }
   if (ncp >= nt) {
+    if (icp >= nt) {
+      *i0 = nt;
+      *i1 = nt;
+      return 0;
+    }
     *i0 = icp;
     *i1 = icp+1;
     return cp[icp].m;
   }
-  mb = m/ncp;
-  mr = m%ncp;
-  printf("geticp: %d %d %d %d %d %d\n", icp, ncp, nt, m, mb, mr);
+  if (!mbpt_cost) {
+    mb = m/ncp;
+    mr = m%ncp;
+    printf("geticp: %d %d %d %d %d %d\n", icp, ncp, nt, m, mb, mr);
+    k = 0;
+    m = 0;
+    *i0 = 0;
+    mb1 = mb;
+    if (k < mr) mb1++;
+    for (i = 0; i < nt; i++) {
+      m += cp[i].m;
+      if (m >= mb1) {
+	if (k == icp) {
+	  *i1 = i+1;
+	  return m;
+	}
+	k++;
+	if (k >= mr) mb1 = mb;
+	m = 0;
+	*i0 = i+1;
+      }
+    }
+    *i1 = nt;
+    return m;
+  }
+  /* split by the estimated cost, each part gets at least one pair */
+  cb = c/ncp;
+  printf("geticp: %d %d %d %d %g\n", icp, ncp, nt, m, cb);
   k = 0;
   m = 0;
+  c = 0;
+  cb1 = cb;
   *i0 = 0;
-  mb1 = mb;
-  if (k < mr) mb1++;
   for (i = 0; i < nt; i++) {
     m += cp[i].m;
-    if (m >= mb1) {
+    c += cp[i].c;
+    if (c >= cb1 || nt-i-1 <= ncp-k-1) {
       if (k == icp) {
 	*i1 = i+1;
-       return m;
+	return m;
       }
       k++;
-      if (k >= mr) mb1 = mb;
+      cb1 += cb;
       m = 0;
       *i0 = i+1;
-    }      
+    }
   }
   *i1 = nt;
   return m;
 }
 
+/*
+** estimated cost of the MBPT terms of a config pair with m state pairs.
+** the 1-virtual terms go as ns^3*nv, the 2-virtual terms as ns^2*nv^2,
+** ns the number of shells in the padded pair, nv of virtual orbitals,
+** each with a factor of the multipole range.
+*/
+static double CostConfigPair(CONFIG *c0, CONFIG *c1, int m, int nb, int n3) {
+  int i, j, ns, nv, kr;
+  double c;
+
+  ns = c0->n_shells;
+  kr = 0;
+  for (i = 0; i < c0->n_shells; i++) {
+    j = GetJFromKappa(c0->shells[i].kappa);
+    if (j > kr) kr = j;
+  }
+  for (i = 0; i < c1->n_shells; i++) {
+    for (j = 0; j < c0->n_shells; j++) {
+      if (c1->shells[i].n == c0->shells[j].n &&
+	  c1->shells[i].kappa == c0->shells[j].kappa) break;
+    }
+    if (j == c0->n_shells) ns++;
+    j = GetJFromKappa(c1->shells[i].kappa);
+    if (j > kr) kr = j;
+  }
+  kr++;
+  nv = Max(1, nb-ns);
+  c = 0.0;
+  if (n3 != 2) c += (double)ns*ns*ns*nv*kr;
+  if (n3 != 1) c += (double)ns*ns*nv*nv*kr;
+  return m*c;
+}
+
+/*
+** a key of the config pair list and the basis, identical for all
+** sub-jobs of the same run.
+*/
+static unsigned long KeyConfigPairs(int ncpt, CONFIG_PAIR *cp,
+				    int nc, int nb, int n3) {
+  unsigned long h;
+  int i, k[3];
+
+  h = 14695981039346656037UL;
+  k[0] = nc;
+  k[1] = nb;
+  k[2] = n3;
+  for (i = 0; i <= ncpt; i++) {
+    if (i > 0) {
+      k[0] = cp[i-1].k0;
+      k[1] = cp[i-1].k1;
+      k[2] = cp[i-1].m;
+    }
+    h = (h ^ (unsigned long) k[0]) * 1099511628211UL;
+    h = (h ^ (unsigned long) k[1]) * 1099511628211UL;
+    h = (h ^ (unsigned long) k[2]) * 1099511628211UL;
+  }
+  return h;
+}
+
+/*
+** the manifest fn.mft of a partial effective hamiltonian, written
+** only after fn is complete. jobs j0..j1 of ncp cover the config
+** pairs p0..p1-1 of ncpt.
+*/
+static int WriteManifestMBPT(char *fn, MBPT_MANIFEST *mf) {
+  char mfn[1100];
+  FILE *f;
+
+  sprintf(mfn, "%s.mft", fn);
+  f = fopen(mfn, "w");
+  if (f == NULL) {
+    MPrintf(-1, "cannot open manifest file %s\n", mfn);
+    return -1;
+  }
+  fprintf(f, "file= %s\n", fn);
+  fprintf(f, "ncp= %d\n", mf->ncp);
+  fprintf(f, "job= %d %d\n", mf->j0, mf->j1);
+  fprintf(f, "ncpt= %d\n", mf->ncpt);
+  fprintf(f, "pairs= %d %d\n", mf->p0, mf->p1);
+  fprintf(f, "key= %016lx\n", mf->key);
+  fprintf(f, "cost= %15.8E\n", mf->cost);
+  fclose(f);
+  return 0;
+}
+
+static int ReadManifestMBPT(char *fn, MBPT_MANIFEST *mf) {
+  char mfn[1100];
+  FILE *f;
+  int n;
+
+  sprintf(mfn, "%s.mft", fn);
+  f = fopen(mfn, "r");
+  if (f == NULL) {
+    printf("missing manifest file %s\n", mfn);
+    return -1;
+  }
+  n = fscanf(f, "file= %1023s\n", mf->fn);
+  n += fscanf(f, "ncp= %d\n", &mf->ncp);
+  n += fscanf(f, "job= %d %d\n", &mf->j0, &mf->j1);
+  n += fscanf(f, "ncpt= %d\n", &mf->ncpt);
+  n += fscanf(f, "pairs= %d %d\n", &mf->p0, &mf->p1);
+  n += fscanf(f, "key= %lx\n", &mf->key);
+  n += fscanf(f, "cost= %lf\n", &mf->cost);
+  fclose(f);
+  if (n != 9) {
+    printf("corrupted manifest file %s\n", mfn);
+    return -1;
+  }
+  return 0;
+}
+
+/*
+** checkpoint of the 1- and 2-virtual accumulators of StructureMBPT1.
+** each rank writes fn.ckp<rank>, with the pair range, the list of
+** the pairs whose sums its accumulators hold, 0 < cdone <= need, and
+** the unnormalized hab1, hba1, hab, hba. the file is written to a
+** temporary and renamed, when no pair is in progress. with mbpt_omp,
+** a thread finishing a pair has done or passed over all its units
+** taken by others, so a pair any thread has finished is complete.
+*/
+static int WriteCheckpointMBPT(char *fn, MBPT_EFF **meff, int nhab, int nhab1,
+			       int ncpt, int icp0, int icp1,
+			       int *cdone, int need) {
+  char cfn[1100], tfn[1110];
+  FILE *f;
+  int i, k, isym, n, nd;
+
+#if USE_MPI == 1
+  i = MyRankMPI();
+#else
+  i = 0;
+#endif
+  sprintf(cfn, "%s.ckp%d", fn, i);
+  sprintf(tfn, "%s.tmp", cfn);
+  f = fopen(tfn, "w");
+  if (f == NULL) {
+    MPrintf(-1, "cannot open checkpoint file %s\n", tfn);
+    return -1;
+  }
+  nd = 0;
+  for (i = icp0; i < icp1; i++) {
+    if (cdone[i-icp0] > 0 && cdone[i-icp0] <= need) nd++;
+  }
+#if USE_MPI == 1
+  n = NProcMPI();
+#else
+  n = 1;
+#endif
+  fwrite(&n, sizeof(int), 1, f);
+  fwrite(&ncpt, sizeof(int), 1, f);
+  fwrite(&icp0, sizeof(int), 1, f);
+  fwrite(&icp1, sizeof(int), 1, f);
+  fwrite(&nhab, sizeof(int), 1, f);
+  fwrite(&nhab1, sizeof(int), 1, f);
+  fwrite(&nd, sizeof(int), 1, f);
+  for (i = icp0; i < icp1; i++) {
+    if (cdone[i-icp0] > 0 && cdone[i-icp0] <= need) {
+      fwrite(&i, sizeof(int), 1, f);
+    }
+  }
+  for (isym = 0; isym < MAX_SYMMETRIES; isym++) {
+    if (meff[isym] == NULL || meff[isym]->nbasis == 0) continue;
+    fwrite(&isym, sizeof(int), 1, f);
+    fwrite(&(meff[isym]->hsize), sizeof(int), 1, f);
+    for (k = 0; k < meff[isym]->hsize; k++) {
+      if (meff[isym]->hab1[k] == NULL) continue;
+      fwrite(&k, sizeof(int), 1, f);
+      fwrite(meff[isym]->hab1[k], sizeof(double), nhab1, f);
+      fwrite(meff[isym]->hba1[k], sizeof(double), nhab1, f);
+      if (nhab > 0) {
+	fwrite(meff[isym]->hab[k], sizeof(double), nhab, f);
+	fwrite(meff[isym]->hba[k], sizeof(double), nhab, f);
+      }
+    }
+    k = -1;
+    fwrite(&k, sizeof(int), 1, f);
+  }
+  isym = -1;
+  fwrite(&isym, sizeof(int), 1, f);
+  if (fclose(f) != 0 || rename(tfn, cfn) != 0) {
+    MPrintf(-1, "cannot write checkpoint file %s\n", cfn);
+    return -1;
+  }
+  return nd;
+}
+
+/*
+** read the checkpoints of a previous run over the same pair range.
+** as each file lists exactly the pairs whose sums it holds, any set of
+** files with disjoint pair lists resumes correctly. the files are taken
+** in order, and one that overlaps a file already taken is skipped,
+** e.g. a stale file of a run with a different number of ranks, whose
+** pairs are then redone. the pairs of the files taken are marked done,
+** cdone = need if the file is read on this rank, which adds the
+** accumulators of file i on rank i%nproc, and need+1 otherwise.
+** a sharded rank has its own pair list, and reads only its own file.
+*/
+static int ReadCheckpointMBPT(char *fn, MBPT_EFF **meff, int nhab, int nhab1,
+			      int ncpt, int icp0, int icp1,
+			      int *cdone, int need) {
+  char cfn[1100];
+  FILE *f;
+  int i, j, k, n, np, isym, hsize, nd, p[6], nb, ierr, i0, own, *kd;
+  double *x;
+
+  x = malloc(sizeof(double)*(Max(nhab, nhab1)+1));
+  kd = malloc(sizeof(int)*(icp1-icp0+1));
+  i0 = 0;
+  np = 1;
+#if USE_MPI == 1
+  if (mbpt_shard) {
+    i0 = MyRankMPI();
+    np = i0+1;
+  } else {
+    np = NProcMPI();
+  }
+#endif
+  ierr = 0;
+  nd = 0;
+  for (i = i0; i < np; i++) {
+    sprintf(cfn, "%s.ckp%d", fn, i);
+    f = fopen(cfn, "r");
+    if (f == NULL) continue;
+    nb = fread(&n, sizeof(int), 1, f);
+    nb = fread(p, sizeof(int), 6, f);
+    if (nb != 6 || p[0] != ncpt || p[1] != icp0 || p[2] != icp1 ||
+	p[3] != nhab || p[4] != nhab1 || p[5] < 0 || p[5] > icp1-icp0) {
+      MPrintf(-1, "checkpoint %s does not match the run: %d %d %d %d %d\n",
+	      cfn, p[0], p[1], p[2], p[3], p[4]);
+      fclose(f);
+      ierr = -1;
+      break;
+    }
+    if (mbpt_shard) {
+#if USE_MPI == 1
+      if (n != NProcMPI()) {
+	MPrintf(-1, "checkpoint %s is from %d sharded ranks\n", cfn, n);
+	fclose(f);
+	ierr = -1;
+	break;
+      }
+#endif
+    } else if (n > np) {
+      np = n;
+    }
+    nb = fread(kd, sizeof(int), p[5], f);
+    if (nb != p[5]) {
+      fclose(f);
+      ierr = -1;
+      MPrintf(-1, "corrupted checkpoint file %s\n", cfn);
+      break;
+    }
+    for (j = 0; j < p[5]; j++) {
+      k = kd[j];
+      if (k < icp0 || k >= icp1 || cdone[k-icp0]) break;
+    }
+    if (j < p[5]) {
+      MPrintf(-1, "checkpoint %s overlaps the files before, skipped\n", cfn);
+      fclose(f);
+      continue;
+    }
+    own = 1;
+#if USE_MPI == 1
+    if (!mbpt_shard && i%NProcMPI() != MyRankMPI()) own = 0;
+#endif
+    for (j = 0; j < p[5]; j++) {
+      cdone[kd[j]-icp0] = own?need:need+1;
+    }
+    nd += p[5];
+    if (!own) {
+      fclose(f);
+      continue;
+    }
+    while (1) {
+      nb = fread(&isym, sizeof(int), 1, f);
+      if (nb != 1 || isym < 0) break;
+      nb = fread(&hsize, sizeof(int), 1, f);
+      if (isym >= MAX_SYMMETRIES || meff[isym] == NULL ||
+	  meff[isym]->hsize != hsize) {
+	ierr = -1;
+	break;
+      }
+      while (1) {
+	nb = fread(&k, sizeof(int), 1, f);
+	if (nb != 1 || k < 0) break;
+	if (k >= hsize || meff[isym]->hab1[k] == NULL) {
+	  ierr = -1;
+	  break;
+	}
+	nb = fread(x, sizeof(double), nhab1, f);
+	for (j = 0; j < nhab1; j++) meff[isym]->hab1[k][j] += x[j];
+	nb = fread(x, sizeof(double), nhab1, f);
+	for (j = 0; j < nhab1; j++) meff[isym]->hba1[k][j] += x[j];
+	if (nhab > 0) {
+	  nb = fread(x, sizeof(double), nhab, f);
+	  for (j = 0; j < nhab; j++) meff[isym]->hab[k][j] += x[j];
+	  nb = fread(x, sizeof(double), nhab, f);
+	  for (j = 0; j < nhab; j++) meff[isym]->hba[k][j] += x[j];
+	}
+      }
+      if (ierr) break;
+    }
+    fclose(f);
+    if (ierr) {
+      MPrintf(-1, "corrupted checkpoint file %s\n", cfn);
+      break;
+    }
+  }
+  free(x);
+  free(kd);
+  if (ierr) return ierr;
+  return nd;
+}
+
+#if USE_MPI == 1
+/*
+** with sharded ranks, the owner of a symmetry writes its records of
+** the effective hamilton file into a memory stream, which rank 0
+** receives and copies into the file in the order of the symmetries.
+** the basis, heff and neff follow, for rank 0 to diagonalize.
+*/
+#define SHARD_CHUNK 0x10000000
+static void SendShardMBPT(FILE *f, char **buf, size_t *n, int isym,
+			  MBPT_EFF *meff) {
+  long m, i, k;
+
+  fclose(f);
+  m = *n;
+  MPI_Send(&m, 1, MPI_LONG, 0, isym, MPI_COMM_WORLD);
+  for (i = 0; i < m; i += k) {
+    k = Min(m-i, SHARD_CHUNK);
+    MPI_Send(*buf+i, k, MPI_BYTE, 0, isym, MPI_COMM_WORLD);
+  }
+  /* the stream buffer is from the libc, not the counted malloc */
+  (free)(*buf);
+  *buf = NULL;
+  *n = 0;
+  m = 0;
+  if (meff) m = meff->nbasis;
+  MPI_Send(&m, 1, MPI_LONG, 0, isym, MPI_COMM_WORLD);
+  if (m <= 0) return;
+  MPI_Send(meff->basis, m, MPI_INT, 0, isym, MPI_COMM_WORLD);
+  MPI_Send(meff->heff, m*m, MPI_DOUBLE, 0, isym, MPI_COMM_WORLD);
+  MPI_Send(meff->neff, m*m, MPI_DOUBLE, 0, isym, MPI_COMM_WORLD);
+}
+
+/*
+** the received effective hamilton has no accumulators.
+*/
+static MBPT_EFF *RecvShardMBPT(FILE *f, int isym, int src) {
+  long m, i, k;
+  char *buf;
+  MBPT_EFF *meff;
+
+  MPI_Recv(&m, 1, MPI_LONG, src, isym, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  buf = malloc(Max(m, 1));
+  for (i = 0; i < m; i += k) {
+    k = Min(m-i, SHARD_CHUNK);
+    MPI_Recv(buf+i, k, MPI_BYTE, src, isym,
+	     MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  }
+  fwrite(buf, 1, m, f);
+  free(buf);
+  MPI_Recv(&m, 1, MPI_LONG, src, isym, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  if (m <= 0) return NULL;
+  meff = malloc(sizeof(MBPT_EFF));
+  meff->n = 0;
+  meff->n2 = 0;
+  meff->nbasis = m;
+  meff->hsize0 = m*m;
+  meff->hsize = m*(m+1)/2;
+  meff->basis = malloc(sizeof(int)*m);
+  meff->heff = malloc(sizeof(double)*m*m);
+  meff->neff = malloc(sizeof(double)*m*m);
+  MPI_Recv(meff->basis, m, MPI_INT, src, isym,
+	   MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  MPI_Recv(meff->heff, m*m, MPI_DOUBLE, src, isym,
+	   MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  MPI_Recv(meff->neff, m*m, MPI_DOUBLE, src, isym,
+	   MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+  meff->idb = malloc(sizeof(IDXARY));
+  InitIdxAry(meff->idb, meff->nbasis, meff->basis);
+  meff->h0 = NULL;
+  meff->e0 = NULL;
+  meff->heff0 = NULL;
+  meff->imbpt = NULL;
+  meff->wmbpt = NULL;
+  meff->hab1 = NULL;
+  meff->hba1 = NULL;
+  meff->hab = NULL;
+  meff->hba = NULL;
+  return meff;
+}
+#endif
+
 int CompareMBPTCC(const void *p1, const void *p2) {
   CONFIG *c1, *c2;
   c1 = *((CONFIG **) p1);
@@ -4513,7 +5102,7 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
   ORBITAL *orb;
   int nkgp;
   int *kgp = NULL;
-  int ip = 0, ncca = 0;
+  int ip = 0, ncca = 0, jobs = 0;
   
   if (mbpt_nwmix <= 0) mbpt_nwmix = 1.0/mbpt_wmix;
   if (nkg00 == 0) {
@@ -4853,15 +5442,52 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
     eu0[i] = 1e31;
     eu1[i] = -1e31;
   }
+  for (isym = 0; isym < MAX_SYMMETRIES; isym++) {
+    meff[isym] = NULL;
+    idb[isym] = NULL;
+  }
+#if USE_MPI == 1
+  int own[MAX_SYMMETRIES];
+  /* 
+  ** with mbpt:shard, the ranks do not replicate the accumulators.
+  ** each keeps the symmetries it has diagonalized, the pairs touching
+  ** them, and sends their effective hamilton to rank 0.
+  ** the transitions need the replicated accumulators.
+  */
+  mbpt_shard = mbpt_shard0 && NProcMPI() > 1;
+  if (mbpt_shard && mbpt_tr.nktr > 0) {
+    MPrintf(-1, "MBPT sharding is off with transitions\n");
+    mbpt_shard = 0;
+  }
+  if (mbpt_shard) {
+    for (isym = 0; isym < MAX_SYMMETRIES; isym++) {
+      h = GetHamilton(isym);
+      own[isym] = -1;
+      if (h->dim > 0 && h->diag_rank == MyRankMPI()) own[isym] = MyRankMPI();
+    }
+    MPI_Allreduce(MPI_IN_PLACE, own, MAX_SYMMETRIES, MPI_INT,
+		  MPI_MAX, MPI_COMM_WORLD);
+  } else if (NProcMPI() > 1) {
+    /* the replicated accumulators need the mixing on every rank */
+    for (isym = 0; isym < MAX_SYMMETRIES; isym++) {
+      h = GetHamilton(isym);
+      if (h->dim <= 0 || h->diag_rank == MyRankMPI()) continue;
+      if (DiagnolizeHamilton(h) < 0) continue;
+      h->diag_rank = MyRankMPI();
+    }
+  }
+#endif
   ResetWidMPI();
 #pragma omp parallel default(shared) private(isym, h, sym, ks, mks, m, mix, k, q, st, i, j, a, b, c, i0, mr)
   {
   mr = MPIRank(NULL);
   for (isym = 0; isym < MAX_SYMMETRIES; isym++) {    
+#if USE_MPI == 1
+    int skip = mbpt_shard && own[isym] != MyRankMPI();
+#else
     int skip = SkipMPI();
+#endif
     if (skip) continue;
-    meff[isym] = NULL;
-    idb[isym] = NULL;
     h = GetHamilton(isym);
     if (h->dim <= 0) {
       continue;
@@ -5047,8 +5673,11 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 #pragma omp parallel default(shared) private(isym, sym, h, i0, i1, mix, i, q, st, k, m)
     {
     for (isym = 0; isym < MAX_SYMMETRIES; isym++) {
+#if USE_MPI != 1
+      /* under MPI, the transition matrices are replicated */
       int skip = SkipMPI();
       if (skip) continue;
+#endif
       h = GetHamilton(isym);
       if (h->dim <= 0) continue;
       sym = GetSymmetry(isym);
@@ -5109,8 +5738,10 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
     HAMILTON *h0, *h1;
     a = mbpt_mcut*mbpt_mcut2;
     for (i0 = 0; i0 < MAX_SYMMETRIES; i0++) {
+#if USE_MPI != 1
       int skip = SkipMPI();
       if (skip) continue;
+#endif
       int ki = 0, ke = 0;
       h0 = GetHamilton(i0);
       if (h0->dim <= 0) continue;
@@ -5219,11 +5850,35 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	ncpt++;
       }
     }    
-    if (ncp > ncpt) {
-      printf("structure ncp > ncpt: %d %d\n", ncp, ncpt);
-      ncp = ncpt;
+    k = ncpt;
+#if USE_MPI == 1
+    /* the sharded pair lists differ, split them alike */
+    if (mbpt_shard) {
+      MPI_Allreduce(MPI_IN_PLACE, &k, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD);
     }
-    if (ncp > 1) {
+#endif
+    if (ncp > k) {
+      printf("structure ncp > ncpt: %d %d\n", ncp, k);
+      ncp = k;
+    }
+    if (ncp > 0 && icpi < 0) {
+      /*
+      ** a batch array job, the index is taken from the environment.
+      ** jobs beyond the clamped ncp have no pairs to compute.
+      */
+      char *pe = getenv("FAC_MBPT_JOB");
+      if (pe == NULL) {
+	printf("FAC_MBPT_JOB is not set for the sub-job index\n");
+	Abort(1);
+      }
+      icpi = atoi(pe);
+      icpf = icpi;
+      jobs = 1;
+    }
+    if (jobs && icpi >= ncp) {
+      printf("MBPT sub-job %d has no config pairs: %d %d\n", icpi, ncp, k);
+      icpf = icpi-1;
+    } else if (ncp > 1) {
       if (icpf == -1) icpf = icpi;
       else if (icpf == -2) icpf = ncp-1;
       else if (icpf < icpi) icpf = icpi;
@@ -5278,21 +5933,27 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	cfgpair[icr].k0 = k0;
 	cfgpair[icr].k1 = k1;
 	cfgpair[icr].m = m;
+	if (mbpt_cost) {
+	  cfgpair[icr].c = CostConfigPair(c0, c1, m, nb, n3);
+	} else {
+	  cfgpair[icr].c = m;
+	}
 	ic++;
       }
     }
     if (rid) free(rid);
     for (icp = icpi; icp <= icpf; icp++) {
+      char *pc = fn1;
+      while(*pc && *pc != '%') pc++;
+      if (*pc) {
+	sprintf(tfn, fn1, icp);
+      } else if (icpf > icpi || jobs) {
+	sprintf(tfn, "%s%02d", fn1, icp);
+      } else {
+	sprintf(tfn, "%s", fn1);
+      }
+      f = NULL;
       if (MyRankMPI() == 0) {
-	char *pc = fn1;
-	while(*pc && *pc != '%') pc++;
-	if (*pc) {
-	  sprintf(tfn, fn1, icp);
-	} else if (icpf > icpi) {
-	  sprintf(tfn, "%s%02d", fn1, icp);
-	} else {
-	  sprintf(tfn, "%s", fn1);
-	}
 	f = fopen(tfn, "w");
 	if (f == NULL) {
 	  MPrintf(-1, "cannot open file %s\n", fn1);
@@ -5416,13 +6077,52 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
       } else {
 	mbpt_omp = 0;
       }
+      int *cdone = NULL;
+      int need = 1, nckp = 0, nbusy = 0, ckpreq = 0;
+      double tckp = WallTime();
+      /* a pending checkpoint holds the start of new pairs */
+      LOCK ckplock;
+      pthread_cond_t ckpcond;
+      if (mbpt_ckp > 0 || mbpt_restart) {
+#if USE_MPI == 1
+	if (mbpt_omp && npr > 1 && !mbpt_shard) {
+	  MPrintf(-1, "MBPT checkpoint disabled with pairs shared by ranks\n");
+	} else {
+	  cdone = malloc(sizeof(int)*(icp1-icp0));
+	}
+#else
+	cdone = malloc(sizeof(int)*(icp1-icp0));
+	/* with mbpt_omp, every thread does its part of every pair */
+	if (mbpt_omp) need = npr;
+#endif
+      }
+      if (cdone) {
+	InitLock(&ckplock);
+	pthread_cond_init(&ckpcond, NULL);
+	for (ic = icp0; ic < icp1; ic++) cdone[ic-icp0] = 0;
+	if (mbpt_restart) {
+	  k = ReadCheckpointMBPT(tfn, meff, nhab, nhab1,
+				 ncpt, icp0, icp1, cdone, need);
+	  if (k < 0) {
+	    MPrintf(-1, "cannot restart from checkpoint %s.ckp\n", tfn);
+	    Abort(1);
+	  }
+	  MPrintf(-1, "MBPT structure restart: %d %d\n", k, icp1-icp0);
+	}
+      }
       double *dm = NULL;
       int *im = NULL;      
+      int *rk = NULL;
+      int *ip = NULL;
       if (mbpt_msort) {
 	dm = malloc(sizeof(double)*(icp1-icp0));
 	im = malloc(sizeof(int)*(icp1-icp0));
 	double amst = tmst/npr;
 	for (ic = icp0; ic < icp1; ic++) {
+	  if (mbpt_cost) {
+	    dm[ic-icp0] = -cfgpair[ic].c;
+	    continue;
+	  }
 	  dm[ic-icp0] = amst/cfgpair[ic].m;
 	  if (cfgpair[ic].k0 != cfgpair[ic].k1) {
 	    dm[ic-icp0] *= mbpt_asort;
@@ -5430,8 +6130,60 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	}
 	ArgSort(icp1-icp0, dm, im);
       }
+      /* the pairs still to do, in the order they are taken */
+      int np = 0;
+      ip = malloc(sizeof(int)*(icp1-icp0));
+      for (i = icp0; i < icp1; i++) {
+	if (im) ic = icp0 + im[i-icp0];
+	else ic = i;
+	if (cdone && cdone[ic-icp0] >= need) continue;
+	ip[np++] = ic;
+      }
+#if USE_MPI == 1
+      /* the threads of USE_MPI == 2 take the pairs dynamically, the
+	 ranks get them statically, longest first to the least loaded
+	 rank. each rank then does its pairs in the order of ip. */
+      if (mbpt_cost && mbpt_omp == 0 && npr > 1 && np > 0 && !mbpt_shard) {
+	double *ld = malloc(sizeof(double)*npr);
+	double *dl = malloc(sizeof(double)*np);
+	int *il = malloc(sizeof(int)*np);
+	rk = malloc(sizeof(int)*np);
+	for (i = 0; i < npr; i++) ld[i] = 0;
+	for (ic = 0; ic < np; ic++) dl[ic] = -cfgpair[ip[ic]].c;
+	ArgSort(np, dl, il);
+	for (ic = 0; ic < np; ic++) {
+	  i0 = 0;
+	  for (i = 1; i < npr; i++) {
+	    if (ld[i] < ld[i0]) i0 = i;
+	  }
+	  rk[il[ic]] = i0;
+	  ld[i0] += cfgpair[ip[il[ic]]].c;
+	}
+	free(dl);
+	free(il);
+	double a = 0, b = 0;
+	for (i = 0; i < npr; i++) {
+	  a += ld[i];
+	  if (ld[i] > b) b = ld[i];
+	}
+	MPrintf(-1, "MBPT structure cost balance: %12.5E %12.5E\n",
+		a/npr, b);
+	free(ld);
+      }
+#endif
       MPrintf(-1, "MBPT structure beg: %12.5E %12.5E\n",
 	      WallTime()-tbg, TotalSize());
+      InitIdxAry(&mbpt_ibas, nb, bas);
+      /* the bound orbitals of the slater tensor */
+      k = GetNumOrbitals();
+      int *bnd = malloc(sizeof(int)*Max(k, 1));
+      for (i = 0, m = 0; i < k; i++) {
+	orb0 = GetOrbital(i);
+	if (orb0->n > 0 && orb0->n <= nmax) {
+	  bnd[m++] = i;
+	}
+      }
+      InitIdxAry(&mbpt_ibnd, m, bnd);
       ResetWidMPI();
 #pragma omp parallel default(shared) private(isym,n0,bra,ket,sbra,sket,bra1,ket1,bra2,ket2,sbra1,sket1,sbra2,sket2,cs,dt,dtt,k0,k1,c0,p0,c1,p1,m,bst0,kst0,m0,m1,ms0,ms1,q,q0,q1,k,mst,i0,i1,ct0,ct1,bst,kst,n1,bas0,bas1,ic,ncps)
       {
@@ -5444,17 +6196,23 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
       bas1 = mbpt_bas1;
       mbpt_ibas0.n = mbpt_ibas0.m = 0;
       mbpt_ibas1.n = mbpt_ibas1.m = 0;
+      InitSlaterTensorMBPT();
       if (mbpt_ccn[0]) {
 	mbpt_cca = malloc(sizeof(ARRAY));
 	ArrayInit(mbpt_cca, sizeof(CONFIG *), 4096);
       }
       int ic0;
-      for (ic0 = icp0; ic0 < icp1; ic0++) {
-	if (SkipMPIM(0)) continue;
-	if (im) {
-	  ic = icp0 + im[ic0-icp0];
-	} else {
-	  ic = ic0;
+      for (ic0 = 0; ic0 < np; ic0++) {
+	if (rk) {
+	  if (rk[ic0] != MyRankMPI()) continue;
+	} else if (SkipMPIM(0)) continue;
+	ic = ip[ic0];
+	if (cdone) {
+	  /* no new pair starts while a checkpoint is pending */
+	  SetLock(&ckplock);
+	  while (ckpreq) pthread_cond_wait(&ckpcond, &ckplock);
+	  nbusy++;
+	  ReleaseLock(&ckplock);
 	}
 	k0 = cfgpair[ic].k0;
 	k1 = cfgpair[ic].k1;
@@ -5553,6 +6311,7 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	mbptjp.sd1a = malloc(sizeof(double)*mst);
 	mbptjp.sd2a = malloc(sizeof(double)*mst);
 	mbptjp.c12a = malloc(sizeof(double)*mst);
+	mbptjp.ca = malloc(sizeof(double)*mst);
 	if (n3 != 2) {
 	  DeltaH12M0(meff, n0, bra2, ket2, sbra2, sket2, mst, bst, kst,
 		     ct0, ct1, &mbpt_ibas0, mbpt_bas0s, mbpt_bas0d,
@@ -5598,6 +6357,7 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	free(mbptjp.sd1a);
 	free(mbptjp.sd2a);
 	free(mbptjp.c12a);
+	free(mbptjp.ca);
 	ptt1 = WallTime();
 	dt = ptt1-ptt0;
 	dtt = ptt1-tbg;
@@ -5621,36 +6381,99 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	    ncps = 0;
 	  }
 	}
+	if (cdone) {
+	  SetLock(&ckplock);
+	  nbusy--;
+	  cdone[ic-icp0]++;
+	  if (mbpt_ckp > 0 && WallTime()-tckp >= mbpt_ckp) ckpreq = 1;
+	  if (ckpreq && nbusy == 0) {
+	    k = WriteCheckpointMBPT(tfn, meff, nhab, nhab1,
+				    ncpt, icp0, icp1, cdone, need);
+	    if (k >= 0) {
+	      nckp++;
+	      MPrintf(-1, "MBPT structure checkpoint: %d %d %d %12.5E\n",
+		      nckp, k, icp1-icp0, WallTime()-tbg);
+	    }
+	    ckpreq = 0;
+	    tckp = WallTime();
+	    pthread_cond_broadcast(&ckpcond);
+	  }
+	  ReleaseLock(&ckplock);
+	}
       }
       ttskip = tskip;
       ttlock = tlock;
       tnlock = nlock;
+      if (mbpt_stn.t) {
+	MPrintf(-1, "MBPT slater tensor: %12.5E\n", mbpt_stn.size);
+	FreeSlaterTensorMBPT();
+      }
+      FreeWorkSpaceMBPT();
       if (mbpt_ccn[0]) {
 #pragma omp atomic
 	ncca += mbpt_cca->dim;
       }
       }
+      FreeIdxAry(&mbpt_ibas, 2);
+      FreeIdxAry(&mbpt_ibnd, 2);
+      free(bnd);
       if (im) {
 	free(dm);
 	free(im);
       }
+      if (rk) free(rk);
+      free(ip);
       MPrintf(-1, "MBPT Structure ... %12.5E %12.5E %12.5E %ld\n",
 	      WallTime()-tbg, TotalSize(), TotalArraySize(), mbpt_ignoren);
       fflush(stdout);
+#if USE_MPI == 1
+      if (NProcMPI() > 1) {
+	ttskip = TimeSkip();
+	ttlock = TimeLock();
+	MPI_Allreduce(MPI_IN_PLACE, &ttskip, 1, MPI_DOUBLE,
+		      MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(MPI_IN_PLACE, &ttlock, 1, MPI_DOUBLE,
+		      MPI_SUM, MPI_COMM_WORLD);
+      }
+#endif
       for (isym = 0; isym < MAX_SYMMETRIES; isym++) {      
+	FILE *fs = NULL;
+	if (MyRankMPI() == 0) fs = f;
+#if USE_MPI == 1
+	char *sbuf = NULL;
+	size_t ssize = 0;
+	if (mbpt_shard) {
+	  /* rank 0 writes the empty records of unowned symmetries */
+	  i = Max(own[isym], 0);
+	  if (i != MyRankMPI()) {
+	    if (fs == NULL) continue;
+	    /* the received heff only sets up the hamilton on rank 0 */
+	    meff[isym] = RecvShardMBPT(fs, isym, i);
+	    if (meff[isym] == NULL) continue;
+	    fs = NULL;
+	  } else if (fs == NULL) {
+	    fs = open_memstream(&sbuf, &ssize);
+	  }
+	}
+#endif
 	if (meff[isym] == NULL || meff[isym]->nbasis == 0) {
 	  k = 0;
-	  if (MyRankMPI() == 0) {
-	    fwrite(&isym, sizeof(int), 1, f);
-	    fwrite(&k, sizeof(int), 1, f);
+	  if (fs) {
+	    fwrite(&isym, sizeof(int), 1, fs);
+	    fwrite(&k, sizeof(int), 1, fs);
+	  }
+#if USE_MPI == 1
+	  if (mbpt_shard && fs != f) {
+	    SendShardMBPT(fs, &sbuf, &ssize, isym, NULL);
 	  }
+#endif
 	  continue;
 	}
 	double wt0 = WallTime();
 	heff = meff[isym]->heff;
 	neff = meff[isym]->neff;
 #if USE_MPI == 1
-	if (NProcMPI() > 1) {
+	if (!mbpt_shard && NProcMPI() > 1) {
 	  for (i = 0; i < meff[isym]->hsize; i++) {
 	    if (meff[isym]->hab1[i] != NULL) {
 	      if (nhab > 0) {
@@ -5669,12 +6492,6 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 			    MPI_SUM, MPI_COMM_WORLD);
 	    }
 	  }
-	  ttskip = TimeSkip();
-	  ttlock = TimeLock();
-	  MPI_Allreduce(MPI_IN_PLACE, &ttskip, 1, MPI_DOUBLE,
-			MPI_SUM, MPI_COMM_WORLD);
-	  MPI_Allreduce(MPI_IN_PLACE, &ttlock, 1, MPI_DOUBLE,
-			MPI_SUM, MPI_COMM_WORLD);
 	}
 #endif
 	h = GetHamilton(isym);
@@ -5690,16 +6507,16 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	h0 = meff[isym]->h0;
 	h->heff = heff;
 	DecodePJ(isym, &pp, &jj);
-	if (MyRankMPI() != 0) continue;   
-	fwrite(&isym, sizeof(int), 1, f);
+	if (fs == NULL) continue;   
+	fwrite(&isym, sizeof(int), 1, fs);
 	if (meff[isym]->heff0) {
 	  k = -meff[isym]->hsize0;
-	  fwrite(&k, sizeof(int), 1, f);
-	  fwrite(meff[isym]->heff0, sizeof(double), meff[isym]->hsize0, f);
+	  fwrite(&k, sizeof(int), 1, fs);
+	  fwrite(meff[isym]->heff0, sizeof(double), meff[isym]->hsize0, fs);
 	}
-	fwrite(&(h->dim), sizeof(int), 1, f);
-	fwrite(meff[isym]->basis, sizeof(int), h->dim, f);
-	fflush(f);
+	fwrite(&(h->dim), sizeof(int), 1, fs);
+	fwrite(meff[isym]->basis, sizeof(int), h->dim, fs);
+	fflush(fs);
 	fflush(stdout);
 	double *wb, *wc, *wbn, *wcn;
 	int iw = 0, nw = 0;
@@ -5747,7 +6564,12 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 		}
 		continue;
 	      }
+	      /* under MPI, the rank writing the symmetry sums all elements */
+#if USE_MPI == 1
+	      int skip = 0;
+#else
 	      int skip = SkipMPI();
+#endif
 	      if (skip) {
 		iw++;
 		continue;
@@ -5814,21 +6636,21 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	    k = j*(j+1)/2 + i;
 	    if (meff[isym]->imbpt[k] <= 0) {
 	      q = -i-1;
-	      fwrite(&q, sizeof(int), 1, f);
+	      fwrite(&q, sizeof(int), 1, fs);
 	      q = -j-1;
-	      fwrite(&q, sizeof(int), 1, f);
+	      fwrite(&q, sizeof(int), 1, fs);
 	      a = h0[k];
-	      fwrite(&a, sizeof(double), 1, f);
+	      fwrite(&a, sizeof(double), 1, fs);
 	      a = 0.0;
-	      fwrite(&a, sizeof(double), 1, f);
-	      fwrite(&a, sizeof(double), 1, f);	    
+	      fwrite(&a, sizeof(double), 1, fs);
+	      fwrite(&a, sizeof(double), 1, fs);	    
 	    } else {
-	      fwrite(&i, sizeof(int), 1, f);
-	      fwrite(&j, sizeof(int), 1, f);
+	      fwrite(&i, sizeof(int), 1, fs);
+	      fwrite(&j, sizeof(int), 1, fs);
 	      a = h0[k];
-	      fwrite(&a, sizeof(double), 1, f);
-	      fwrite(&wb[iw], sizeof(double), 1, f);
-	      fwrite(&wc[iw], sizeof(double), 1, f);
+	      fwrite(&a, sizeof(double), 1, fs);
+	      fwrite(&wb[iw], sizeof(double), 1, fs);
+	      fwrite(&wc[iw], sizeof(double), 1, fs);
 	      if (mbpt_savesum == 0) {
 		hab1 = meff[isym]->hab1[k];
 		hba1 = meff[isym]->hba1[k];
@@ -5839,22 +6661,22 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 		  hab = NULL;
 		  hba = NULL;
 		}
-		fwrite(hab1, sizeof(double), nhab1, f);
+		fwrite(hab1, sizeof(double), nhab1, fs);
 		if (i != j) {
-		  fwrite(hba1, sizeof(double), nhab1, f);
+		  fwrite(hba1, sizeof(double), nhab1, fs);
 		}
 		if (n3 != 1 && nhab > 0) {
-		  fwrite(hab, sizeof(double), nhab, f);
+		  fwrite(hab, sizeof(double), nhab, fs);
 		  if (i != j) {
-		    fwrite(hba, sizeof(double), nhab, f);
+		    fwrite(hba, sizeof(double), nhab, fs);
 		  }
 		}
 	      } else {
-		fwrite(&wb[iw], sizeof(double), 1, f);
-		fwrite(&wbn[iw], sizeof(double), 1, f);
+		fwrite(&wb[iw], sizeof(double), 1, fs);
+		fwrite(&wbn[iw], sizeof(double), 1, fs);
 		if (i != j) {
-		  fwrite(&wc[iw], sizeof(double), 1, f);
-		  fwrite(&wcn[iw], sizeof(double), 1,f );
+		  fwrite(&wc[iw], sizeof(double), 1, fs);
+		  fwrite(&wcn[iw], sizeof(double), 1, fs);
 		}	      
 	      }
 	      iw++;
@@ -5867,9 +6689,35 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	  free(wbn);
 	  free(wcn);
 	}
-	fflush(f);
+	fflush(fs);
 	double wt1 = WallTime();
 	MPrintf(-1, "SumInterpH: %d %d %d %10.3E\n", isym, h->dim, nw, wt1-wt0);
+#if USE_MPI == 1
+	if (mbpt_shard && fs != f) {
+	  SendShardMBPT(fs, &sbuf, &ssize, isym, meff[isym]);
+	}
+#endif
+      }
+      if (cdone) {
+	/* the effective hamilton is saved, drop the checkpoints */
+#if USE_MPI == 1
+	MPI_Barrier(MPI_COMM_WORLD);
+#endif
+	char cfn[1100];
+#if USE_MPI == 1
+	k = NProcMPI();
+	i = MyRankMPI();
+#else
+	k = 1;
+	i = 0;
+#endif
+	for (; ; i += k) {
+	  sprintf(cfn, "%s.ckp%d", tfn, i);
+	  if (remove(cfn) != 0) break;
+	}
+	free(cdone);
+	DestroyLock(&ckplock);
+	pthread_cond_destroy(&ckpcond);
       }
       if (icpf == icpi && fn != NULL && strlen(fn) > 0) {
 	ResetWidMPI();   
@@ -5877,7 +6725,12 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	{
 	  for (isym = 0; isym < MAX_SYMMETRIES; isym++) { 
 	    if (meff[isym] == NULL) continue;
+#if USE_MPI == 1
+	    /* rank 0 has all effective hamiltons, and saves the levels */
+	    int skip = MyRankMPI() != 0;
+#else
 	    int skip = SkipMPI();
+#endif
 	    if (skip) continue;
 	    h = GetHamilton(isym);
 	    if (h->dim <= 0) continue;
@@ -5933,7 +6786,24 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	  fflush(stdout);
 	}
       }
-      fclose(f);
+      if (f) {
+	fclose(f);
+	if (ncp > 1 || jobs) {
+	  MBPT_MANIFEST mf;
+	  mf.ncp = ncp;
+	  mf.j0 = icp;
+	  mf.j1 = icp;
+	  mf.ncpt = ncpt;
+	  mf.p0 = icp0;
+	  mf.p1 = icp1;
+	  mf.key = KeyConfigPairs(ncpt, cfgpair, nc, nb, n3);
+	  mf.cost = 0.0;
+	  for (ic = icp0; ic < icp1; ic++) {
+	    mf.cost += cfgpair[ic].c;
+	  }
+	  WriteManifestMBPT(tfn, &mf);
+	}
+      }
     }
     free(cfgpair);
   }
@@ -5959,13 +6829,18 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 #pragma omp parallel default(shared) private(k0, c0, k1, c1, m, m0, ms0, i0, q0, p0, j0, pp0, pp1, m1, ms1, i1, q1, p1, j1, i, j, ic, mr)
     {
     mr = MPIRank(NULL);
+#if USE_MPI != 1
     int w = 0;
+#endif
     for (k0 = 0; k0 < nc; k0++) {
       c0 = cs[k0];
       for (k1 = 0; k1 < nc; k1++) {
 	c1 = cs[k1];
-	if (SkipWMPI(w++)) continue;
 	ic = k0 + k1*nc;
+#if USE_MPI != 1
+	/* under MPI, every rank needs the whole pair list */
+	if (SkipWMPI(w++)) continue;
+#endif
 	cfgpair0[ic].m = 0;
 	m = 0;      
 	for (m0 = 0; m0 < c0->n_csfs; m0++) {
@@ -6028,6 +6903,7 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	cfgpair[icr].k0 = cfgpair0[i].k0;
 	cfgpair[icr].k1 = cfgpair0[i].k1;
 	cfgpair[icr].m = m;
+	cfgpair[icr].c = m;
 	ic++;
       }
     }
@@ -6198,6 +7074,7 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	  }
 	}
       }
+      FreeWorkSpaceMBPT();
     }
     if (im) {
       free(dm);
@@ -6216,7 +7093,7 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	      m = meff[mtr[j].isym0]->n*mbpt_tr.naw;	      
 	      MPI_Allreduce(MPI_IN_PLACE, mtr[j].pma[i][p0]->tma, m,
 			    MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
-	      MPI_Allreduce(MPI_IN_PLACE, mtr[j].pma[i][p0]->tma, m,
+	      MPI_Allreduce(MPI_IN_PLACE, mtr[j].pma[i][p0]->rma, m,
 			    MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
 	    }
 	  }
@@ -6279,8 +7156,11 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 	for (i = 0; i < mtr[j].nsym1; i++) {
 	  for (m0 = 0; m0 < mtr[j].ndim0; m0++) {
 	    for (m1 = 0; m1 < mtr[j].ndim1[i]; m1++) {
+#if USE_MPI != 1
+	      /* under MPI, rank 0 needs all sums */
 	      int skip = SkipMPI();
 	      if (skip) continue;
+#endif
 	      p0 = m0*mtr[j].ndim1[i] + m1;
 	      if (mtr[j].pma[i][p0] == NULL) continue;
 	      for (q0 = 0; q0 < mbpt_tr.naw; q0++) {
@@ -6350,6 +7230,7 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
   }
   
  ERROR:
+  mbpt_shard = 0;
   FreeIdxAry(&mbpt_ibas0, 2);
   FreeIdxAry(&mbpt_ibas1, 2);
   FreeIdxAry(&ing, 2);
@@ -6606,6 +7487,296 @@ int ReadMBPT(int nf, FILE *f[], MBPT_HAM *mbpt, int m) {
   return 0;
 }
 
+#define MAXMERGEMBPT 128
+
+static int CompareManifestMBPT(const void *p1, const void *p2) {
+  const MBPT_MANIFEST *m1, *m2;
+
+  m1 = (const MBPT_MANIFEST *) p1;
+  m2 = (const MBPT_MANIFEST *) p2;
+  return m1->j0 - m2->j0;
+}
+
+/*
+** sum the partial effective hamiltonians of the sub-jobs in mf into
+** fn. the parts share the radial grids and the bases, only the
+** 2nd order terms of their config pairs differ. the files are
+** streamed one matrix element at a time.
+*/
+static int SumHeffMBPT(char *fn, int nf, MBPT_MANIFEST *mf) {
+  FILE **f1, *f;
+  int m, i, j, k, n, n2, n3, isym, dim, hsize0;
+  int nh1, nh2, ibra, iket, ib, ik, ib0, ik0;
+  int *ng, *ng2, *ip, *bs, nbs;
+  double a, b, c, x[3], *acc, *buf, *h0;
+  int ierr = -1;
+
+  f1 = malloc(sizeof(FILE *)*nf);
+  for (m = 0; m < nf; m++) f1[m] = NULL;
+  f = NULL;
+  ng = NULL;
+  ng2 = NULL;
+  ip = NULL;
+  acc = NULL;
+  buf = NULL;
+  h0 = NULL;
+  bs = NULL;
+  nbs = 0;
+  for (m = 0; m < nf; m++) {
+    f1[m] = fopen(mf[m].fn, "r");
+    if (f1[m] == NULL) {
+      printf("cannot open file %s\n", mf[m].fn);
+      goto DONE;
+    }
+  }
+  f = fopen(fn, "w");
+  if (f == NULL) {
+    printf("cannot open file %s\n", fn);
+    goto DONE;
+  }
+  for (m = 0; m < nf; m++) {
+    if (fread(&k, sizeof(int), 1, f1[m]) != 1) goto TRUNC;
+    if (m == 0) {
+      n = k;
+      ng = malloc(sizeof(int)*n*2);
+      ip = ng + n;
+    } else if (k != n) goto DIFF;
+    if (fread(ip, sizeof(int), n, f1[m]) != n) goto TRUNC;
+    if (m == 0) {
+      memcpy(ng, ip, sizeof(int)*n);
+    } else if (memcmp(ng, ip, sizeof(int)*n)) goto DIFF;
+    if (fread(&k, sizeof(int), 1, f1[m]) != 1) goto TRUNC;
+    if (m == 0) {
+      n2 = k;
+      if (n2 > 0) ng2 = malloc(sizeof(int)*n2*2);
+    } else if (k != n2) goto DIFF;
+    if (n2 > 0) {
+      if (fread(ng2+n2, sizeof(int), n2, f1[m]) != n2) goto TRUNC;
+      if (m == 0) {
+	memcpy(ng2, ng2+n2, sizeof(int)*n2);
+      } else if (memcmp(ng2, ng2+n2, sizeof(int)*n2)) goto DIFF;
+    }
+    if (fread(&k, sizeof(int), 1, f1[m]) != 1) goto TRUNC;
+    if (m == 0) n3 = k;
+    else if (k != n3) goto DIFF;
+  }
+  fwrite(&n, sizeof(int), 1, f);
+  fwrite(ng, sizeof(int), n, f);
+  fwrite(&n2, sizeof(int), 1, f);
+  if (n2 > 0) fwrite(ng2, sizeof(int), n2, f);
+  fwrite(&n3, sizeof(int), 1, f);
+  nh1 = 2*n;
+  nh2 = 0;
+  if (n3 != 1 && n2 > 0) nh2 = 2*n*n2;
+  k = 2*(nh1+nh2);
+  acc = malloc(sizeof(double)*k);
+  buf = malloc(sizeof(double)*k);
+  for (isym = 0; isym < MAX_SYMMETRIES; isym++) {
+    for (m = 0; m < nf; m++) {
+      if (fread(&k, sizeof(int), 1, f1[m]) != 1) goto TRUNC;
+      if (k != isym) goto DIFF;
+      if (fread(&k, sizeof(int), 1, f1[m]) != 1) goto TRUNC;
+      if (m == 0) hsize0 = k<0?-k:0;
+      else if ((k<0?-k:0) != hsize0) goto DIFF;
+      if (k < 0) {
+	if (m == 0) h0 = malloc(sizeof(double)*hsize0);
+	if (fread(h0, sizeof(double), hsize0, f1[m]) != hsize0) goto TRUNC;
+	if (m == 0) {
+	  fwrite(&isym, sizeof(int), 1, f);
+	  k = -hsize0;
+	  fwrite(&k, sizeof(int), 1, f);
+	  fwrite(h0, sizeof(double), hsize0, f);
+	}
+	if (fread(&k, sizeof(int), 1, f1[m]) != 1) goto TRUNC;
+      } else if (m == 0) {
+	fwrite(&isym, sizeof(int), 1, f);
+      }
+      if (m == 0) {
+	dim = k;
+	fwrite(&dim, sizeof(int), 1, f);
+	if (dim > nbs) {
+	  if (bs) free(bs);
+	  bs = malloc(sizeof(int)*dim);
+	  nbs = dim;
+	}
+      } else if (k != dim) goto DIFF;
+      if (dim > 0) {
+	if (fread(bs, sizeof(int), dim, f1[m]) != dim) goto TRUNC;
+	if (m == 0) fwrite(bs, sizeof(int), dim, f);
+      }
+    }
+    if (h0) {
+      free(h0);
+      h0 = NULL;
+    }
+    for (j = 0; j < dim; j++) {
+      for (i = 0; i <= j; i++) {
+	ib = -1;
+	ik = -1;
+	a = 0.0;
+	b = 0.0;
+	c = 0.0;
+	for (k = 0; k < 2*(nh1+nh2); k++) acc[k] = 0.0;
+	for (m = 0; m < nf; m++) {
+	  if (fread(&ibra, sizeof(int), 1, f1[m]) != 1) goto TRUNC;
+	  if (fread(&iket, sizeof(int), 1, f1[m]) != 1) goto TRUNC;
+	  if (fread(x, sizeof(double), 3, f1[m]) != 3) goto TRUNC;
+	  if (m == 0) {
+	    ib0 = ibra;
+	    ik0 = iket;
+	    a = x[0];
+	  }
+	  if (ibra < 0 || iket < 0) continue;
+	  ib = ibra;
+	  ik = iket;
+	  b += x[1];
+	  c += x[2];
+	  k = nh1;
+	  if (ibra != iket) k += nh1;
+	  if (nh2 > 0) {
+	    k += nh2;
+	    if (ibra != iket) k += nh2;
+	  }
+	  if (fread(buf, sizeof(double), k, f1[m]) != k) goto TRUNC;
+	  for (k--; k >= 0; k--) acc[k] += buf[k];
+	}
+	if (ib < 0) {
+	  fwrite(&ib0, sizeof(int), 1, f);
+	  fwrite(&ik0, sizeof(int), 1, f);
+	  x[0] = a;
+	  x[1] = 0.0;
+	  x[2] = 0.0;
+	  fwrite(x, sizeof(double), 3, f);
+	  continue;
+	}
+	fwrite(&ib, sizeof(int), 1, f);
+	fwrite(&ik, sizeof(int), 1, f);
+	x[0] = a;
+	x[1] = b;
+	x[2] = c;
+	fwrite(x, sizeof(double), 3, f);
+	k = nh1;
+	if (ib != ik) k += nh1;
+	if (nh2 > 0) {
+	  k += nh2;
+	  if (ib != ik) k += nh2;
+	}
+	fwrite(acc, sizeof(double), k, f);
+      }
+    }
+  }
+  ierr = 0;
+  goto DONE;
+
+ TRUNC:
+  printf("truncated MBPT file %s\n", mf[m].fn);
+  goto DONE;
+ DIFF:
+  printf("MBPT file %s does not match %s\n", mf[m].fn, mf[0].fn);
+
+ DONE:
+  for (m = 0; m < nf; m++) {
+    if (f1[m]) fclose(f1[m]);
+  }
+  free(f1);
+  if (f) fclose(f);
+  if (ng) free(ng);
+  if (ng2) free(ng2);
+  if (acc) free(acc);
+  if (buf) free(buf);
+  if (h0) free(h0);
+  if (bs) free(bs);
+  if (ierr < 0) remove(fn);
+  return ierr;
+}
+
+/*
+** merge the partial effective hamiltonians fn1 of the sub-jobs of
+** StructureMBPT1 into fn, which can then be read by StructureReadMBPT
+** as a single file. the manifests must show the same run and cover
+** all sub-jobs exactly once.
+*/
+int MergeMBPT(char *fn, int nf, char *fn1[]) {
+  MBPT_MANIFEST *mf, *mf1, mft;
+  int i, m, n, ierr;
+  double wt0;
+  char tfn[1024];
+
+  if (MyRankMPI() != 0) return 0;
+  if (nf <= 0) return -1;
+  wt0 = WallTime();
+  mf = malloc(sizeof(MBPT_MANIFEST)*nf);
+  for (i = 0; i < nf; i++) {
+    if (ReadManifestMBPT(fn1[i], &mf[i]) < 0) {
+      free(mf);
+      return -1;
+    }
+    strncpy(mf[i].fn, fn1[i], 1023);
+    mf[i].fn[1023] = '\0';
+  }
+  qsort(mf, nf, sizeof(MBPT_MANIFEST), CompareManifestMBPT);
+  ierr = 0;
+  m = 0;
+  for (i = 0; i < nf; i++) {
+    if (mf[i].ncp != mf[0].ncp || mf[i].ncpt != mf[0].ncpt ||
+	mf[i].key != mf[0].key) {
+      printf("MBPT file %s is from a different run than %s\n",
+	     mf[i].fn, mf[0].fn);
+      ierr = -1;
+      continue;
+    }
+    if (mf[i].j0 < m) {
+      printf("MBPT sub-job %d is repeated in %s\n", mf[i].j0, mf[i].fn);
+      ierr = -1;
+    } else if (mf[i].j0 > m) {
+      printf("MBPT sub-jobs missing: %d - %d\n", m, mf[i].j0-1);
+      ierr = -1;
+    }
+    if (mf[i].j1+1 > m) m = mf[i].j1+1;
+  }
+  if (m < mf[0].ncp) {
+    printf("MBPT sub-jobs missing: %d - %d\n", m, mf[0].ncp-1);
+    ierr = -1;
+  }
+  if (ierr < 0) {
+    printf("incomplete MBPT sub-jobs, %s is not written\n", fn);
+    free(mf);
+    return -1;
+  }
+  mft = mf[0];
+  mft.j1 = mf[nf-1].j1;
+  mft.p1 = mf[nf-1].p1;
+  for (i = 1; i < nf; i++) {
+    mft.cost += mf[i].cost;
+  }
+  if (nf <= MAXMERGEMBPT) {
+    ierr = SumHeffMBPT(fn, nf, mf);
+  } else {
+    /* limit the open files, merge in groups first */
+    n = (nf+MAXMERGEMBPT-1)/MAXMERGEMBPT;
+    mf1 = malloc(sizeof(MBPT_MANIFEST)*n);
+    for (i = 0; i < n && ierr == 0; i++) {
+      m = Min(MAXMERGEMBPT, nf-i*MAXMERGEMBPT);
+      sprintf(tfn, "%s.m%d", fn, i);
+      mf1[i] = mf[i*MAXMERGEMBPT];
+      strcpy(mf1[i].fn, tfn);
+      ierr = SumHeffMBPT(tfn, m, mf+i*MAXMERGEMBPT);
+    }
+    if (ierr == 0) ierr = SumHeffMBPT(fn, n, mf1);
+    for (i = 0; i < n; i++) {
+      remove(mf1[i].fn);
+    }
+    free(mf1);
+  }
+  if (ierr == 0) {
+    WriteManifestMBPT(fn, &mft);
+    printf("MergeMBPT: %d %d %d %12.5E %12.5E\n",
+	   nf, mft.ncp, mft.ncpt, mft.cost, WallTime()-wt0);
+  }
+  free(mf);
+  return ierr;
+}
+
 void CombineMBPT0(int nf, MBPT_HAM *mbpt, 
 		  double *hab1, double *hba1,
 		  double **hab, double **hba, 
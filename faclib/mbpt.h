@@ -84,8 +84,17 @@ typedef struct _CONFIG_PAIR_ {
   int k0;
   int k1;
   int m;
+  double c;
 } CONFIG_PAIR;
 
+typedef struct _MBPT_MANIFEST_ {
+  int ncp, j0, j1;
+  int ncpt, p0, p1;
+  unsigned long key;
+  double cost;
+  char fn[1024];
+} MBPT_MANIFEST;
+
 void InitMBPT(void);
 int StructureMBPT0(char *fn, double de, double ccut, int n, int *s0, int kmax, 
 		   int n1, int *nm, int n2, int *nmp, int n3, int *n3g,
@@ -96,6 +105,7 @@ int StructureMBPT1(char *fn, char *fn0, char *fn1,
 		   int ncp, int icp, int icpf);
 int StructureReadMBPT(char *fn, char *fn2, int nf, char *fn1[], 
 		      int nkg, int *kg, int nkg0);
+int MergeMBPT(char *fn, int nf, char *fn1[]);
 void SetExtraMBPT(int m);
 void SetExcMBPT(int nd, int ns, double wd, double ws, char *s);
 void SetOptMBPT(int i3rd, int n3, double c, double d, double e, double f);
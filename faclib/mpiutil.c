@@ -182,7 +182,9 @@ void ResetWidMPI(void) {
     Abort(1);
   }
 #endif
-  _cwid = -1;  
+  /* a thread running with nproc=1 inside a team must not reset the
+     team's counter */
+  if (mpi.nproc > 1) _cwid = -1;
 #pragma omp parallel
   {
   mpi.wid = 0;
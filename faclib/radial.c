@@ -163,8 +163,26 @@ static ORBMAP *_orbmap = NULL;
 
 static AVERAGE_CONFIG average_config = {0, 0, NULL, NULL, NULL, 0, NULL, NULL};
 
+static double _continuum_interp = 0.0;
+
+/* 
+** frequency tables of the Breit Y-functions for the retardation
+** energies not covered by xbreit_array. the nw nodes are equally
+** spaced by dw from 0 to w1.
+*/
+typedef struct _BREITWTB_ {
+  short nw, npts;
+  double w1, dw;
+  float *yk;
+} BREITWTB;
+
+static double _breit_wtol = 0.0;
+static int _breit_nw = 4;
+static int _breit_maxnw = 128;
+
 static MULTI *slater_array;
 static MULTI *xbreit_array[5];
+static MULTI *fbreit_array[4];
 static MULTI *wbreit_array;
 static MULTI *breit_array;
 static MULTI *vinti_array;
@@ -178,11 +196,15 @@ static MULTI *yk_array;
 #define MAXNAW 128
 static int n_awgrid = 0;
 static double awgrid[MAXNAW];
+/* spherical bessel functions j_n(awgrid[i]*r) for n < _nawbes */
+static int _nawbes = 0;
+static double *_awbes = NULL;
 #define MAXMP 8
 static int _nmp = 0;
 static double *_dmp[2][2][MAXMP];
 
 static double PhaseRDependent(double x, double eta, double b);
+static ORBITAL *AppendOrbitalNoLock(int n, int kappa, double e);
 
 #ifdef PERFORM_STATISTICS
 static RAD_TIMING rad_timing = {0, 0, 0, 0};
@@ -221,6 +243,7 @@ void LoadRadialMultipole(char *fn) {
   if (r == EOF) {
     return;
   }
+  FreeMultipoleBessel();
   _nmp = n1;
   int nmp2 = _nmp*_nmp;
   nsq = nmp2*nmp2*naw;
@@ -583,6 +606,11 @@ void SetOrbMap(int k, int n0, int n1, int n2) {
       free(_orbmap[i].opn);
       free(_orbmap[i].onn);
       free(_orbmap[i].ozn);
+      free(_orbmap[i].ezn);
+      if (_orbmap[i].zlock) {
+	DestroyLock(_orbmap[i].zlock);
+	free(_orbmap[i].zlock);
+      }
     }
     free(_orbmap);
   }
@@ -598,6 +626,18 @@ void SetOrbMap(int k, int n0, int n1, int n2) {
     _orbmap[i].opn = malloc(sizeof(ORBITAL *)*_norbmap0);
     _orbmap[i].onn = malloc(sizeof(ORBITAL *)*_norbmap1);
     _orbmap[i].ozn = malloc(sizeof(ORBITAL *)*_norbmap2);
+    _orbmap[i].ezn = malloc(sizeof(double)*_norbmap2);
+#if USE_MPI == 2
+    _orbmap[i].zlock = (LOCK *) malloc(sizeof(LOCK));
+    if (0 != InitLock(_orbmap[i].zlock)) {
+      printf("cannot InitLock in SetOrbMap\n");
+      free(_orbmap[i].zlock);
+      _orbmap[i].zlock = NULL;
+      Abort(1);
+    }
+#else
+    _orbmap[i].zlock = NULL;
+#endif
     for (j = 0; j < _norbmap0; j++) {
       _orbmap[i].opn[j] = NULL;
     }
@@ -606,6 +646,7 @@ void SetOrbMap(int k, int n0, int n1, int n2) {
     }
     for (j = 0; j < _norbmap2; j++) {
       _orbmap[i].ozn[j] = NULL;
+      _orbmap[i].ezn[j] = 0.0;
     }
   }
 }
@@ -905,6 +946,30 @@ static void InitFltAryData(void *p, int n) {
   }
 }
 
+static void InitBreitWTB(void *p, int n) {
+  BREITWTB *d;
+  int i;
+
+  d = (BREITWTB *) p;
+  for (i = 0; i < n; i++) {
+    d[i].nw = -1;
+    d[i].npts = -1;
+    d[i].yk = NULL;
+  }
+}
+
+static void FreeBreitWTB(void *p) {
+  BREITWTB *dp;
+
+  dp = (BREITWTB *) p;
+  if (dp->nw > 0) {
+    free(dp->yk);
+    dp->yk = NULL;
+    dp->nw = -1;
+    dp->npts = -1;
+  }
+}
+
 int FreeSimpleArray(MULTI *ma) {
   MultiFreeData(ma, NULL);
   return 0;
@@ -939,6 +1004,7 @@ static void FreeFltAryData(void *p) {
 
 int FreeMultipoleArray(void) {
   MultiFreeData(multipole_array, FreeMultipole);
+  FreeMultipoleBessel();
   LoadRadialMultipole(NULL);
   return 0;
 }
@@ -965,6 +1031,9 @@ int FreeBreitArray(void) {
   for (i = 0; i < 5; i++) {
     MultiFreeData(xbreit_array[i], FreeFltAryData);
   }
+  for (i = 0; i < 4; i++) {
+    MultiFreeData(fbreit_array[i], FreeBreitWTB);
+  }
   return 0;
 }
 
@@ -1507,6 +1576,7 @@ void SetMS(int nms, int sms) {
 
 int SetAWGrid(int n, double awmin, double awmax) {
   int i;
+  FreeMultipoleBessel();
   if (awmin < 1E-3) {
     awmin = 1E-3;
     awmax = awmax + 1E-3;
@@ -1529,6 +1599,55 @@ int GetAWGrid(double **a) {
   return n_awgrid;
 }
 
+void FreeMultipoleBessel(void) {
+  if (_nawbes > 0) {
+    free(_awbes);
+    _awbes = NULL;
+    _nawbes = 0;
+  }
+}
+
+/* 
+** tabulate the spherical bessel functions needed by the multipole 
+** operators of rank up to |m| on the current photon energy grid, so that 
+** all orbital pairs and multipoles share them. must be called outside 
+** of parallel regions, after SetAWGrid.
+*/
+void PrepMultipoleBessel(int m) {
+  int n, i, j, jy, nb;
+  double a, *p;
+
+  nb = abs(m)+2;
+  if (_nawbes >= nb) return;
+  FreeMultipoleBessel();
+  _awbes = malloc(sizeof(double)*nb*n_awgrid*potential->maxrp);
+  jy = 1;
+  p = _awbes;
+  for (n = 0; n < nb; n++) {
+    for (i = 0; i < n_awgrid; i++) {
+      a = awgrid[i];
+      for (j = 0; j < potential->maxrp; j++) {
+	p[j] = BESLJN(jy, n, a*potential->rad[j]);
+      }
+      p += potential->maxrp;
+    }
+  }
+  _nawbes = nb;
+}
+
+static double *MultipoleBessel(int n, int i, double a, int npts, double *y) {
+  int j, jy;
+
+  if (n < _nawbes && a == awgrid[i]) {
+    return _awbes + (n*n_awgrid + i)*potential->maxrp;
+  }
+  jy = 1;
+  for (j = 0; j <= npts; j++) {
+    y[j] = BESLJN(jy, n, a*potential->rad[j]);
+  }
+  return y;
+}
+
 void SetOptimizeMaxIter(int m) {
   optimize_control.maxiter = m;
 }
@@ -3023,6 +3142,108 @@ int GetNumContinua(void) {
   return n_continua;
 }
 
+static int FindContinuum(ORBMAP *om, double e, int k0, int k1) {
+  int k;
+
+  for (k = k0; k < k1; k++) {
+    if (fabs(e-om->ezn[k]) < EPS10) return k;
+  }
+  return -1;
+}
+
+/* 
+ * construct a free orbital from two solved neighbors of the same kappa
+ * bracketing its energy. the inner solution, and the amplitude and phase
+ * beyond ilast, are interpolated linearly in energy. returns -1 if no
+ * suitable neighbors exist, in which case the orbital must be solved.
+ */
+static int InterpolateContinuum(ORBMAP *om, ORBITAL *orb) {
+  int i, k, i0, i1, n, ilast;
+  double e, e0, e1, w0, w1, *p, *p0, *p1;
+  ORBITAL *orb0, *orb1;
+
+  if (_continuum_interp <= 0) return -1;
+  e = orb->energy;
+  i0 = -1;
+  i1 = -1;
+  for (k = 0; k < om->nzn; k++) {
+    if (om->ezn[k] < e) {
+      if (i0 < 0 || om->ezn[k] > om->ezn[i0]) i0 = k;
+    } else {
+      if (i1 < 0 || om->ezn[k] < om->ezn[i1]) i1 = k;
+    }
+  }
+  if (i0 < 0 || i1 < 0) return -1;
+  orb0 = om->ozn[i0];
+  orb1 = om->ozn[i1];
+  e0 = orb0->energy;
+  e1 = orb1->energy;
+  if (e1-e0 > _continuum_interp*e) return -1;
+  if (orb0->wfun == NULL || orb1->wfun == NULL) return -1;
+  ilast = orb0->ilast;
+  if (orb1->ilast != ilast || orb0->kv != orb1->kv) return -1;
+  n = potential->maxrp;
+  p0 = orb0->wfun;
+  p1 = orb1->wfun;
+  /* the phases must belong to the same branch. */
+  if (ilast+2 < n && fabs(p1[ilast+2]-p0[ilast+2]) > 0.25*PI) return -1;
+  p = malloc(sizeof(double)*2*n);
+  if (!p) return -1;
+  w1 = (e-e0)/(e1-e0);
+  w0 = 1.0-w1;
+  for (i = 0; i < 2*n; i++) {
+    p[i] = w0*p0[i] + w1*p1[i];
+  }
+  orb->wfun = p;
+  orb->phase = NULL;
+  orb->ilast = ilast;
+  orb->kv = orb0->kv;
+  orb->qr_norm = 1.0;
+  orb->bqp0 = w0*orb0->bqp0 + w1*orb1->bqp0;
+  orb->pdx = w0*orb0->pdx + w1*orb1->pdx;
+  orb->rfn = 0;
+  orb->isol = 1;
+  return 0;
+}
+
+/* 
+ * free orbitals are looked up lock free in the per kappa orbmap. an
+ * orbital is only entered into the map after it is solved, and the
+ * solution is done under the per kappa lock, so that the expensive
+ * continuum solutions do not serialize on the orbital table lock.
+ */
+static int ContinuumIndex(ORBMAP *om, int kappa, double e) {
+  ORBITAL *orb;
+  int k, nz;
+
+  nz = om->nzn;
+  k = FindContinuum(om, e, 0, nz);
+  if (k >= 0) return om->ozn[k]->idx;
+  if (om->zlock) SetLock(om->zlock);
+  k = FindContinuum(om, e, nz, om->nzn);
+  if (k >= 0) {
+    if (om->zlock) ReleaseLock(om->zlock);
+    return om->ozn[k]->idx;
+  }
+  if (orbitals->lock) SetLock(orbitals->lock);
+  orb = AppendOrbitalNoLock(0, kappa, e);
+  if (orbitals->lock) ReleaseLock(orbitals->lock);
+  if (InterpolateContinuum(om, orb) < 0) {
+    k = SolveDirac(orb);
+    if (k < 0) {
+      MPrintf(-1, "Error occured in solving Dirac eq. err = %d\n", k);
+      Abort(1);
+    }
+  }
+  if (!orb->isol) {
+    printf("isol0c: %d %d %d %g\n", orb->idx, orb->n, orb->kappa, orb->energy);
+    Abort(1);
+  }
+  AddOrbMap(orb);
+  if (om->zlock) ReleaseLock(om->zlock);
+  return orb->idx;
+}
+
 int OrbitalIndex(int n, int kappa, double energy) {
   ORBITAL *orb = NULL;
   int k = ((abs(kappa)-1)*2)+(kappa>0);
@@ -3032,34 +3253,23 @@ int OrbitalIndex(int n, int kappa, double energy) {
     Abort(1);
   }
   ORBMAP *om = &_orbmap[k];
+  if (n == 0) {
+    return ContinuumIndex(om, kappa, energy);
+  }
   if (n > 0) {
     k = n-1;
     orb = om->opn[k];
-  } else if (n < 0) {
+  } else {
     k = -n-1;
     orb = om->onn[k];
-  } else {
-    for (k = 0; k < om->nzn; k++) {
-      if (fabs(energy-om->ozn[k]->energy) < EPS10) {
-	orb = om->ozn[k];
-	break;
-      }
-    }
   }
   if (orb == NULL) {
     if (orbitals->lock) {
       SetLock(orbitals->lock);
       if (n > 0) {
 	orb = om->opn[k];
-      } else if (n < 0) {
-	orb = om->onn[k];
       } else {
-	for (; k < om->nzn; k++) {
-	  if (fabs(energy-om->ozn[k]->energy) < EPS10) {
-	    orb = om->ozn[k];
-	    break;
-	  }
-	}
+	orb = om->onn[k];
       }
     }
     if (orb == NULL) {
@@ -3230,6 +3440,8 @@ void AddOrbMap(ORBITAL *orb) {
       Abort(1);
     }
     om->ozn[om->nzn] = orb;
+    om->ezn[om->nzn] = orb->energy;
+#pragma omp flush
     om->nzn++;
   }
 }
@@ -3321,7 +3533,7 @@ ORBITAL *GetOrbitalSolvedNoLock(int k) {
   return orb;
 }
 
-ORBITAL *GetNewOrbitalNoLock(int n, int kappa, double e) {
+static ORBITAL *AppendOrbitalNoLock(int n, int kappa, double e) {
   ORBITAL *orb;
 
   orb = (ORBITAL *) ArrayAppend(orbitals, NULL, InitOrbitalData);
@@ -3337,6 +3549,13 @@ ORBITAL *GetNewOrbitalNoLock(int n, int kappa, double e) {
   if (n == 0) {
     n_continua++;
   }
+  return orb;
+}
+
+ORBITAL *GetNewOrbitalNoLock(int n, int kappa, double e) {
+  ORBITAL *orb;
+
+  orb = AppendOrbitalNoLock(n, kappa, e);
   AddOrbMap(orb);
 #pragma omp flush
   return orb;
@@ -4885,8 +5104,8 @@ int MultipoleRadialFRGrid(double **p0, int m, int k1, int k2, int gauge) {
   int am, t;
   int index[4], s;
   ORBITAL *orb1, *orb2, *orb;
-  double x, a, r, rp, ef, **p1;
-  int jy, n, i, j, npts;
+  double a, r, rp, ef, **p1, *yb, *zb;
+  int n, i, j, npts;
   double rcl;
 
 #ifdef PERFORM_STATISTICS 
@@ -4970,7 +5189,6 @@ int MultipoleRadialFRGrid(double **p0, int m, int k1, int k2, int gauge) {
     if (orb1->n > 0) npts = Min(npts, orb1->ilast);
     if (orb2->n > 0) npts = Min(npts, orb2->ilast);
     r = 0.0;
-    jy = 1;
     
     for (i = 0; i < n_awgrid; i++) {
       r = 0.0;
@@ -4980,12 +5198,8 @@ int MultipoleRadialFRGrid(double **p0, int m, int k1, int k2, int gauge) {
       if (m > 0) {
 	t = kappa1 + kappa2;
 	if (t) {
-	  for (j = 0; j <= npts; j++) {
-	    x = a*potential->rad[j];
-	    n = m;
-	    _yk[j] = BESLJN(jy, n, x);
-	  }
-	  Integrate(_yk, orb1, orb2, 4, &r, 0);
+	  yb = MultipoleBessel(m, i, a, npts, _yk);
+	  Integrate(yb, orb1, orb2, 4, &r, 0);
 	  r *= t;
 	  r *= (2*m + 1.0)/sqrt(m*(m+1.0));
 	  r /= pow(a, m);
@@ -4995,23 +5209,18 @@ int MultipoleRadialFRGrid(double **p0, int m, int k1, int k2, int gauge) {
 	if (gauge == G_COULOMB) {
 	  t = kappa1 - kappa2;
 	  q = sqrt(am/(am+1.0));
-	  for (j = 0; j <= npts; j++) {
-	    x = a*potential->rad[j];
-	    n = am+1;
-	    _yk[j] = BESLJN(jy, n, x);
-	    n = am-1;
-	    _zk[j] = BESLJN(jy, n, x);
-	  }
+	  yb = MultipoleBessel(am+1, i, a, npts, _yk);
+	  zb = MultipoleBessel(am-1, i, a, npts, _zk);
 	  r = 0.0;
 	  rp = 0.0;
 	  if (t) {
-	    Integrate(_yk, orb1, orb2, 4, &ip, 0);
-	    Integrate(_zk, orb1, orb2, 4, &ipm, 0);
+	    Integrate(yb, orb1, orb2, 4, &ip, 0);
+	    Integrate(zb, orb1, orb2, 4, &ipm, 0);
 	    r = t*ip*q - t*ipm/q;
 	  }
 	  if (k1 != k2) {
-	    Integrate(_yk, orb1, orb2, 5, &im, 0);
-	    Integrate(_zk, orb1, orb2, 5, &imm, 0);
+	    Integrate(yb, orb1, orb2, 5, &im, 0);
+	    Integrate(zb, orb1, orb2, 5, &imm, 0);
 	    rp = (am + 1.0)*im*q + am*imm/q;
 	  }
 	  r += rp;
@@ -5019,23 +5228,18 @@ int MultipoleRadialFRGrid(double **p0, int m, int k1, int k2, int gauge) {
 	  pt[i] = r*rcl;
 	} else if (gauge == G_BABUSHKIN) {
 	  t = kappa1 - kappa2;
-	  for (j = 0; j <= npts; j++) {
-	    x = a*potential->rad[j];
-	    n = am+1;
-	    _yk[j] = BESLJN(jy, n, x);
-	    n = am;
-	    _zk[j] = BESLJN(jy, n, x);
-	  }
+	  yb = MultipoleBessel(am+1, i, a, npts, _yk);
+	  zb = MultipoleBessel(am, i, a, npts, _zk);
 	  if (t) {
-	    Integrate(_yk, orb1, orb2, 4, &ip, 0);
+	    Integrate(yb, orb1, orb2, 4, &ip, 0);
 	    r = t*ip;
 	  }
 	  if (k1 != k2) {
-	    Integrate(_yk, orb1, orb2, 5, &im, 0);
+	    Integrate(yb, orb1, orb2, 5, &im, 0);
 	  } else {
 	    im = 0.0;
 	  }
-	  Integrate(_zk, orb1, orb2, 1, &imm, 0);
+	  Integrate(zb, orb1, orb2, 1, &imm, 0);
 	  rp = (am + 1.0) * (imm + im);
 	  q = (2*am + 1.0)/sqrt(am*(am+1.0));
 	  q /= pow(a, am);
@@ -6424,50 +6628,13 @@ double BreitI(int n, int k0, int k1, int k2, int k3, int m) {
   return r;
 }
 
-int BreitX(ORBITAL *orb0, ORBITAL *orb1, int k, int m, int w, int mbr,
-	   double e, double *y) {
+static int BreitXDirect(ORBITAL *orb0, ORBITAL *orb1, int k, int m,
+			double e, double *y) {
   int i;
   double kf = 1.0;
-  double x, r, b;
+  double x, b;
   int k2 = 2*k;
-  int jy, k1, fd, rs;
-  int index[3];  
-  FLTARY *byk;
-
-  if (y == NULL) y = _xk;
-  if (e < 0) e = fabs(orb0->energy-orb1->energy);
-  byk = NULL;
-  LOCK *lock = NULL;
-  int locked = 0;
-  int myrank = MyRankMPI()+1;
-  if ((mbr == 2 || (m < 3 && w == 0) || (m == 3 && w == 1))
-      && xbreit_array[m]->maxsize != 0) {
-    index[0] = orb0->idx;
-    index[1] = orb1->idx;
-    index[2] = k;
-    byk = (FLTARY *) MultiSet(xbreit_array[m], index, NULL, &lock,
-			      InitFltAryData, FreeFltAryData);
-    if (lock && byk->npts <= 0) {
-      SetLock(lock);
-      locked = 1;
-    }
-    if (byk->npts > 0) {
-      for (i = 0; i < byk->npts; i++) {
-	if (e > 0) {
-	  _dwork1[i] = FINE_STRUCTURE_CONST*e*potential->rad[i];
-	} else {
-	  _dwork1[i] = 0;
-	}
-	_dwork2[i] = pow(potential->rad[i], k);
-	y[i] = byk->yk[i];
-      }
-      if (locked) ReleaseLock(lock);
-#pragma omp atomic
-      xbreit_array[m]->iset -= myrank;
-#pragma omp flush
-      return byk->npts;
-    }     
-  }
+  int jy, k1;
 
   for (i = 1; i < k2; i += 2) {
     kf *= i;
@@ -6543,11 +6710,192 @@ int BreitX(ORBITAL *orb0, ORBITAL *orb1, int k, int m, int w, int mbr,
     }
     break;
   }
-  int npts;
   for (i = potential->maxrp-1; i >= 0; i--) {
     if (y[i]) break;
   }
-  npts = i+1;
+  return i+1;
+}
+
+/*
+** the frequency table of a bound pair holds the Y-functions of BreitXDirect
+** at nw frequencies equally spaced between 0 and the largest binding 
+** energy, which bounds any bound-bound retardation energy. the Y-functions
+** are analytic in e^2, and quadratic interpolation in e is used between
+** the nodes. the grid is refined by bisection until the interpolated
+** midpoints agree with the direct values to within _breit_wtol.
+*/
+static void InterpBreitWTB(float *yk, int nw, int ny, double u,
+			   int npts, double *y) {
+  int i, i0;
+  double a0, a1, a2;
+  float *y0, *y1, *y2;
+
+  i0 = (int)(u+0.5) - 1;
+  if (i0 < 0) i0 = 0;
+  if (i0 > nw-3) i0 = nw-3;
+  u -= i0;
+  a0 = 0.5*(u-1.0)*(u-2.0);
+  a1 = -u*(u-2.0);
+  a2 = 0.5*u*(u-1.0);
+  y0 = yk + i0*ny;
+  y1 = y0 + ny;
+  y2 = y1 + ny;
+  for (i = 0; i < npts; i++) {
+    y[i] = a0*y0[i] + a1*y1[i] + a2*y2[i];
+  }
+}
+
+static void BuildBreitWTB(BREITWTB *t, ORBITAL *orb0, ORBITAL *orb1,
+			  int k, int m) {
+  int i, j, nw, nn, ny, npts, np;
+  double dw, err, ymax, d;
+  float *yk, *yn;
+  double *y;
+
+  ny = potential->maxrp;
+  nw = _breit_nw+1;
+  dw = t->w1/(nw-1);
+  y = malloc(sizeof(double)*ny);
+  yk = malloc(sizeof(float)*nw*ny);
+  npts = 0;
+  for (j = 0; j < nw; j++) {
+    np = BreitXDirect(orb0, orb1, k, m, j*dw, y);
+    if (np > npts) npts = np;
+    for (i = 0; i < ny; i++) yk[j*ny+i] = y[i];
+  }
+  while (2*nw-1 <= _breit_maxnw) {
+    nn = 2*nw-1;
+    yn = malloc(sizeof(float)*nn*ny);
+    err = 0.0;
+    for (j = 0; j < nw-1; j++) {
+      np = BreitXDirect(orb0, orb1, k, m, (j+0.5)*dw, y);
+      if (np > npts) npts = np;
+      InterpBreitWTB(yk, nw, ny, j+0.5, ny, _dwork);
+      ymax = 0.0;
+      d = 0.0;
+      for (i = 0; i < ny; i++) {
+	ymax = Max(ymax, fabs(y[i]));
+	d = Max(d, fabs(y[i]-_dwork[i]));
+	yn[(2*j+1)*ny+i] = y[i];
+      }
+      if (ymax > 0) d /= ymax;
+      if (d > err) err = d;
+    }
+    for (j = 0; j < nw; j++) {
+      memcpy(yn+2*j*ny, yk+j*ny, sizeof(float)*ny);
+    }
+    free(yk);
+    yk = yn;
+    nw = nn;
+    dw *= 0.5;
+    if (err <= _breit_wtol) break;
+  }
+  free(y);
+  t->yk = malloc(sizeof(float)*nw*npts);
+  for (j = 0; j < nw; j++) {
+    memcpy(t->yk+j*npts, yk+j*ny, sizeof(float)*npts);
+  }
+  free(yk);
+  t->npts = npts;
+  t->dw = dw;
+#pragma omp flush
+  t->nw = nw;
+}
+
+static int BreitXTable(ORBITAL *orb0, ORBITAL *orb1, int k, int m,
+		       double e, double *y) {
+  int i, index[3], npts;
+  double w1;
+  BREITWTB *t;
+  LOCK *lock = NULL;
+  int locked = 0;
+  int myrank = MyRankMPI()+1;
+
+  if (m == 1 || e <= 0) return -1;
+  if (orb0->n == 0 || orb1->n == 0) return -1;
+  if (fbreit_array[m]->maxsize == 0) return -1;
+  index[0] = orb0->idx;
+  index[1] = orb1->idx;
+  index[2] = k;
+  t = (BREITWTB *) MultiSet(fbreit_array[m], index, NULL, &lock,
+			    InitBreitWTB, FreeBreitWTB);
+  if (lock && t->nw <= 0) {
+    SetLock(lock);
+    locked = 1;
+  }
+  if (t->nw <= 0) {
+    w1 = 0.0;
+    for (i = 0; i < n_orbitals; i++) {
+      ORBITAL *orb = GetOrbital(i);
+      if (orb->n > 0 && orb->energy < w1) w1 = orb->energy;
+    }
+    t->w1 = -w1;
+    BuildBreitWTB(t, orb0, orb1, k, m);
+    AddMultiSize(fbreit_array[m], sizeof(float)*t->nw*t->npts);
+  }
+  if (locked) ReleaseLock(lock);
+  if (e > t->w1) {
+    npts = -1;
+  } else {
+    npts = t->npts;
+    InterpBreitWTB(t->yk, t->nw, npts, e/t->dw, npts, y);
+  }
+#pragma omp atomic
+  fbreit_array[m]->iset -= myrank;
+#pragma omp flush
+  if (npts < 0) return -1;
+  for (i = 0; i < npts; i++) {
+    _dwork1[i] = FINE_STRUCTURE_CONST*e*potential->rad[i];
+    _dwork2[i] = pow(potential->rad[i], k);
+  }
+  return npts;
+}
+
+int BreitX(ORBITAL *orb0, ORBITAL *orb1, int k, int m, int w, int mbr,
+	   double e, double *y) {
+  int i;
+  int index[3];  
+  FLTARY *byk;
+
+  if (y == NULL) y = _xk;
+  if (e < 0) e = fabs(orb0->energy-orb1->energy);
+  byk = NULL;
+  LOCK *lock = NULL;
+  int locked = 0;
+  int myrank = MyRankMPI()+1;
+  if ((mbr == 2 || m == 1 || (m < 3 && w == 0) || (m == 3 && w == 1))
+      && xbreit_array[m]->maxsize != 0) {
+    index[0] = orb0->idx;
+    index[1] = orb1->idx;
+    index[2] = k;
+    byk = (FLTARY *) MultiSet(xbreit_array[m], index, NULL, &lock,
+			      InitFltAryData, FreeFltAryData);
+    if (lock && byk->npts <= 0) {
+      SetLock(lock);
+      locked = 1;
+    }
+    if (byk->npts > 0) {
+      for (i = 0; i < byk->npts; i++) {
+	if (e > 0) {
+	  _dwork1[i] = FINE_STRUCTURE_CONST*e*potential->rad[i];
+	} else {
+	  _dwork1[i] = 0;
+	}
+	_dwork2[i] = pow(potential->rad[i], k);
+	y[i] = byk->yk[i];
+      }
+      if (locked) ReleaseLock(lock);
+#pragma omp atomic
+      xbreit_array[m]->iset -= myrank;
+#pragma omp flush
+      return byk->npts;
+    }     
+  } else if (_breit_wtol > 0) {
+    i = BreitXTable(orb0, orb1, k, m, e, y);
+    if (i >= 0) return i;
+  }
+
+  int npts = BreitXDirect(orb0, orb1, k, m, e, y);
   if (byk) {
     int size = sizeof(float)*npts;
     byk->yk = malloc(size);
@@ -7370,6 +7718,96 @@ int GetYk(int k, double *yk, ORBITAL *orb1, ORBITAL *orb2,
   return 0;
 }  
 
+/*
+ * scalar integral of two bound orbitals over [0, i1]. the integrand
+ * u1*v1 + c*u2*v2 of type t is formed and summed with the Newton-Cotes
+ * weights in a single pass, which is equivalent to IntegrateSubRegion
+ * with m = 0 (or -1 for id < 0) followed by NewtonCotes, but needs
+ * neither the integrand nor the result work arrays.
+ */
+static double IntegrateBound(double *f, ORBITAL *orb1, ORBITAL *orb2,
+			     int t, int i1, int id) {
+  int i, k;
+  double *u1, *v1, *u2, *v2, *dr;
+  double c, a, b, r, x0, xk, x1;
+
+  switch (t) {
+  case 1:
+    u1 = Large(orb1); v1 = Large(orb2);
+    u2 = Small(orb1); v2 = Small(orb2);
+    c = 1.0;
+    break;
+  case 2:
+    u1 = Large(orb1); v1 = Large(orb2);
+    u2 = u1; v2 = v1;
+    c = 0.0;
+    break;
+  case 3:
+    u1 = Small(orb1); v1 = Small(orb2);
+    u2 = u1; v2 = v1;
+    c = 0.0;
+    break;
+  case 4:
+    u1 = Large(orb1); v1 = Small(orb2);
+    u2 = Small(orb1); v2 = Large(orb2);
+    c = 1.0;
+    break;
+  case 5:
+    u1 = Large(orb1); v1 = Small(orb2);
+    u2 = Small(orb1); v2 = Large(orb2);
+    c = -1.0;
+    break;
+  case 6:
+    u1 = Large(orb1); v1 = Small(orb2);
+    u2 = u1; v2 = v1;
+    c = 0.0;
+    break;
+  default:
+    return 0.0;
+  }
+  dr = potential->dr_drho;
+  a = 0.0;
+  b = 0.0;
+  if (id >= 0) {
+    k = i1-1;
+    for (i = 1; i < i1; i += 2) {
+      a += (u1[i]*v1[i] + c*(u2[i]*v2[i]))*(f[i]*dr[i]);
+    }
+    for (i = 2; i < k; i += 2) {
+      b += (u1[i]*v1[i] + c*(u2[i]*v2[i]))*(f[i]*dr[i]);
+    }
+    x0 = (u1[0]*v1[0] + c*(u2[0]*v2[0]))*(f[0]*dr[0]);
+    r = x0 + 4.0*a + 2.0*b;
+    if (i == i1) {
+      x1 = (u1[i1]*v1[i1] + c*(u2[i1]*v2[i1]))*(f[i1]*dr[i1]);
+      r = (r + x1)/3.0;
+    } else {
+      xk = (u1[k]*v1[k] + c*(u2[k]*v2[k]))*(f[k]*dr[k]);
+      x1 = (u1[i1]*v1[i1] + c*(u2[i1]*v2[i1]))*(f[i1]*dr[i1]);
+      r = (r + xk)/3.0 + 0.5*(xk + x1);
+    }
+  } else {
+    k = 1;
+    for (i = i1-1; i > 0; i -= 2) {
+      a += (u1[i]*v1[i] + c*(u2[i]*v2[i]))*(f[i]*dr[i]);
+    }
+    for (i = i1-2; i > k; i -= 2) {
+      b += (u1[i]*v1[i] + c*(u2[i]*v2[i]))*(f[i]*dr[i]);
+    }
+    x1 = (u1[i1]*v1[i1] + c*(u2[i1]*v2[i1]))*(f[i1]*dr[i1]);
+    r = x1 + 4.0*a + 2.0*b;
+    if (i == 0) {
+      x0 = (u1[0]*v1[0] + c*(u2[0]*v2[0]))*(f[0]*dr[0]);
+      r = (r + x0)/3.0;
+    } else {
+      xk = (u1[k]*v1[k] + c*(u2[k]*v2[k]))*(f[k]*dr[k]);
+      x0 = (u1[0]*v1[0] + c*(u2[0]*v2[0]))*(f[0]*dr[0]);
+      r = (r + xk)/3.0 + 0.5*(xk + x0);
+    }
+  }
+  return r;
+}
+
 /* integrate a function given by f with two orbitals. */
 /* type indicates the type of integral */
 /* type = 1,    P1*P2 + Q1*Q2 */
@@ -7388,6 +7826,13 @@ int Integrate(double *f, ORBITAL *orb1, ORBITAL *orb2,
   double *r, ext;
 
   if (t == 0) t = 1;
+  if (t > 0 && t < 7 && orb1->n != 0 && orb2->n != 0) {
+    ilast = Min(orb1->ilast, orb2->ilast);
+    if (ilast > 2) {
+      *x = IntegrateBound(f, orb1, orb2, t, ilast, id);
+      return 0;
+    }
+  }
   if (t < 0) {
     r = x;
     type = -t;
@@ -8450,6 +8895,9 @@ void LimitArrayRadial(int m, double n) {
     for (i = 0; i <= 4; i++) {
       xbreit_array[i]->cth = n;
     }
+    for (i = 0; i <= 3; i++) {
+      fbreit_array[i]->cth = n;
+    }
     break;
   case -1:
     LimitMultiSize(NULL, n);
@@ -8528,6 +8976,18 @@ void LimitArrayRadial(int m, double n) {
   case 124:
     xbreit_array[m-120]->cth = n;    
     break;
+  case 25:
+  case 26:
+  case 27:
+  case 28:
+    LimitMultiSize(fbreit_array[m-25], n);
+    break;
+  case 125:
+  case 126:
+  case 127:
+  case 128:
+    fbreit_array[m-125]->cth = n;
+    break;
   default:
     printf("nothing is done\n");
     break;
@@ -8619,6 +9079,13 @@ int InitRadial(void) {
     MultiInit(xbreit_array[i], sizeof(FLTARY), ndim, blocks, id);
     xbreit_array[i]->cth = cth;
   }
+  for (i = 0; i < 4; i++) {
+    fbreit_array[i] = (MULTI *) malloc(sizeof(MULTI));
+    char id[MULTI_IDLEN];
+    sprintf(id, "fbreit_array%d", i);
+    MultiInit(fbreit_array[i], sizeof(BREITWTB), ndim, blocks, id);
+    fbreit_array[i]->cth = cth;
+  }
   
   ndim = 2;
   for (i = 0; i < ndim; i++) blocks[i] = MULTI_BLOCK2;
@@ -8669,6 +9136,9 @@ void SetRadialCleanFlags(void) {
   for (i = 0; i < 5; i++) {
     SetMultiCleanFlag(xbreit_array[i]);
   }
+  for (i = 0; i < 4; i++) {
+    SetMultiCleanFlag(fbreit_array[i]);
+  }
   SetMultiCleanFlag(wbreit_array);
   ReportMultiStats();
 }
@@ -8696,6 +9166,7 @@ int ReinitRadial(int m) {
 	optimize_control.n_screen = 0;
       }
       potential->flag = 0;
+      FreeMultipoleBessel();
       n_awgrid = 1;
       awgrid[0] = EPS3;
       SetRadialGrid(DMAXRP, -1.0, -1.0, -1.0, -1.0);
@@ -8896,11 +9367,20 @@ int TestIntegrate(void) {
 }
 
 void RemoveOrbitalLock(void) {
+  int i;
+  
   if (orbitals->lock) {
     DestroyLock(orbitals->lock);
     free(orbitals->lock);
     orbitals->lock = NULL;
   }
+  for (i = 0; i < _korbmap; i++) {
+    if (_orbmap[i].zlock) {
+      DestroyLock(_orbmap[i].zlock);
+      free(_orbmap[i].zlock);
+      _orbmap[i].zlock = NULL;
+    }
+  }
 }
 
 int TestIntegrate0(void) {
@@ -9860,6 +10340,24 @@ void SetOptionRadial(char *s, char *sp, int ip, double dp) {
     _acfg_wmode = ip;
     return;
   }
+  if (0 == strcmp(s, "radial:continuum_interp")) {
+    _continuum_interp = dp;
+    return;
+  }
+  if (0 == strcmp(s, "radial:breit_wtol")) {
+    _breit_wtol = dp;
+    return;
+  }
+  if (0 == strcmp(s, "radial:breit_nw")) {
+    _breit_nw = ip;
+    if (_breit_nw < 2) _breit_nw = 2;
+    return;
+  }
+  if (0 == strcmp(s, "radial:breit_maxnw")) {
+    _breit_maxnw = ip;
+    if (_breit_maxnw > 16384) _breit_maxnw = 16384;
+    return;
+  }
   if (0 == strcmp(s, "radial:maxnhd")) {
     InitHydrogenicDipole(ip);
     return;
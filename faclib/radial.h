@@ -48,6 +48,8 @@ typedef struct _orbmap_ {
   ORBITAL **onn;
   int nzn, nmax;
   ORBITAL **ozn;
+  double *ezn;
+  LOCK *zlock;
 } ORBMAP;
 
 double *WLarge(ORBITAL *orb);
@@ -71,6 +73,8 @@ int GetBreit(void);
 void SetMS(int nms, int sms);
 int SetAWGrid(int n, double min, double max);
 int GetAWGrid(double **a);
+void PrepMultipoleBessel(int m);
+void FreeMultipoleBessel(void);
 int SetRadialGrid(int maxrp, double ratio, double asymp,
 		  double rmin, double qr);
 double SetPotential(AVERAGE_CONFIG *acfg, int iter);
@@ -17,6 +17,7 @@
  */
 
 #include <time.h>
+#include <limits.h>
 
 #include "structure.h"
 #include "cf77.h"
@@ -40,6 +41,62 @@ USE (rcsid);
         }
 #endif /* (FAC_DEBUG >= DEBUG_STRUCTURE) */
 
+/*
+** configuration pairs differing by more than two electrons do not
+** interact, ic maps the basis to the distinct configurations and map
+** is the nc x nc bit table of the interacting pairs.
+*/
+typedef struct _CFGSCREEN_ {
+  int nc;
+  int *ic;
+  unsigned char *map;
+} CFGSCREEN;
+
+/*
+** hamiltonian elements of a previous run, see LoadHamiltonReuse.
+** ib maps the states of the current symmetry to the old basis, od is
+** the old diagonal, and row a holds the elements (a, ir[k]), ir[k] > a.
+** pairs of old perturbers, a >= nd, were not stored. sp is set for the
+** rows of band-screened hamiltonians, which hold only the elements that
+** passed the screening.
+*/
+typedef struct _HAMREUSE_ {
+  int ns, nb, nd, sp;
+  int *ib;
+  double *od;
+  int *nr;
+  int **ir;
+  double **r;
+} HAMREUSE;
+
+/*
+** matrix elements of one symmetry evaluated in the perturbation
+** iterations, open addressing on the state index pair.
+*/
+typedef struct _HAMCACHE_ {
+  long n, m;
+  unsigned long long *k;
+  double *r;
+} HAMCACHE;
+
+/*
+** packed angular coefficient lists of the state pairs. the indices
+** (k, k0, k1, ...) of a list are delta encoded against the previous term
+** as zigzag varints. the state pairs of one configuration pair mostly
+** share these patterns, which are kept once in a dictionary. only the
+** coefficients are stored per list, as float with angz_pack > 1 if the
+** rounding stays below angz_cut.
+*/
+typedef struct _ANGZ_PATTERN_ {
+  struct _ANGZ_PATTERN_ *next;
+  int nb;
+  unsigned char b[1];
+} ANGZ_PATTERN;
+
+#define ANGZ_NDICT 65536
+/* the buckets h of the dictionary share the locks h%ANGZ_NLOCK */
+#define ANGZ_NLOCK 256
+
 static int nhams = 0;
 static int _max_hams = MAX_HAMS;
 static SHAMILTON *hams = NULL;
@@ -66,6 +123,9 @@ static ARRAY *ecorrections;
 static int ci_level = 0;
 static int rydberg_ignored = 0;
 static double angz_cut = ANGZCUT;
+static int angz_pack = 1;
+static ANGZ_PATTERN **angz_dict = NULL;
+static LOCK angz_dict_lock[ANGZ_NLOCK];
 static double mix_cut = MIXCUT;
 static double mix_cut2 = MIXCUT2;
 static double perturb_threshold = -1;
@@ -84,7 +144,26 @@ static double diag_bcut = 5e-2;
 static int diag_nzm = 100;
 static int diag_nbm = 32;
 static double diag_bignore = 0.25;
+static int diag_nlev = 0;
+static double diag_emax = 0.0;
+static double diag_dtol = 1e-8;
+static int diag_dmaxiter = 200;
+static int diag_dcmin = 256;
+static int diag_mixed = 0;
+static double diag_ftol = 1e-5;
+static int diag_rmaxiter = 30;
+static int diag_rnsub = 12;
+static int ham_screen = 1;
+static int sched_nmin = 128;
+static int diag_dist = 0;
+static char ham_inc[256] = "";
+static HAMREUSE *_hreuse = NULL;
+static int perturb_cache = 1;
+static HAMCACHE *_hcache = NULL;
+static double (*_hcache_fhe)(int, int, int) = NULL;
 static int full_name = 0;
+static int level_name = 1;
+static int save_block = 4096;
 
 static int sym_pp = -1;
 static int sym_njj = 0;
@@ -272,6 +351,10 @@ int SetAngZCut(double cut) {
   return 0;
 }
 
+double GetAngZCut(void) {
+  return angz_cut;
+}
+
 int SetMixCut(double cut, double cut2) {
   if (cut >= 0) mix_cut = cut;
   else cut = MIXCUT;
@@ -581,6 +664,451 @@ int ConstructHamiltonEB(int n, int *ilev) {
   return -1;
 }
 
+static int ConfigsInteract(CONFIG *c0, CONFIG *c1) {
+  int i, j, k, d;
+
+  i = 0;
+  j = 0;
+  d = 0;
+  while (i < c0->n_shells || j < c1->n_shells) {
+    if (i == c0->n_shells) {
+      k = -1;
+    } else if (j == c1->n_shells) {
+      k = 1;
+    } else {
+      k = CompareShell(c0->shells+i, c1->shells+j);
+    }
+    if (k > 0) {
+      d += c0->shells[i].nq;
+      i++;
+    } else if (k < 0) {
+      j++;
+    } else {
+      if (c0->shells[i].nq > c1->shells[j].nq) {
+	d += c0->shells[i].nq - c1->shells[j].nq;
+      }
+      i++;
+      j++;
+    }
+    if (d > 2) return 0;
+  }
+  return 1;
+}
+
+static void FreeConfigScreen(CFGSCREEN *cs) {
+  if (cs->nc > 0) {
+    free(cs->ic);
+    free(cs->map);
+  }
+  cs->nc = 0;
+  cs->ic = NULL;
+  cs->map = NULL;
+}
+
+static int ScreenedPair(CFGSCREEN *cs, int i, int j) {
+  size_t k;
+
+  if (cs->nc <= 0) return 0;
+  k = ((size_t) cs->ic[i])*cs->nc + cs->ic[j];
+  return !(cs->map[k>>3] & (1 << (k&7)));
+}
+
+static int InitConfigScreen(CFGSCREEN *cs, HAMILTON *h) {
+  int i, j, k, ng, nt, *ioff, *idx;
+  size_t t, nb;
+  SYMMETRY *sym;
+  STATE *s;
+  CONFIG **cfg;
+
+  cs->nc = 0;
+  cs->ic = NULL;
+  cs->map = NULL;
+  if (!ham_screen || ci_level == -1) return -1;
+  sym = GetSymmetry(h->pj);
+  ng = GetNumGroups();
+  ioff = malloc(sizeof(int)*(ng+1));
+  ioff[0] = 0;
+  for (k = 0; k < ng; k++) {
+    ioff[k+1] = ioff[k] + GetGroup(k)->n_cfgs;
+  }
+  nt = ioff[ng];
+  idx = malloc(sizeof(int)*nt);
+  for (k = 0; k < nt; k++) idx[k] = -1;
+  cs->ic = malloc(sizeof(int)*h->n_basis);
+  cfg = malloc(sizeof(CONFIG *)*h->n_basis);
+  for (i = 0; i < h->n_basis; i++) {
+    s = (STATE *) ArrayGet(&(sym->states), h->basis[i]);
+    if (s->kgroup < 0 || s->kgroup >= ng) break;
+    k = ioff[s->kgroup] + s->kcfg;
+    if (idx[k] < 0) {
+      idx[k] = cs->nc;
+      cfg[cs->nc] = GetConfigFromGroup(s->kgroup, s->kcfg);
+      cs->nc++;
+    }
+    cs->ic[i] = idx[k];
+  }
+  free(ioff);
+  free(idx);
+  if (i < h->n_basis || cs->nc < 2) {
+    free(cs->ic);
+    free(cfg);
+    cs->nc = 0;
+    cs->ic = NULL;
+    return -1;
+  }
+  nb = (((size_t) cs->nc)*cs->nc + 7)>>3;
+  cs->map = calloc(nb, 1);
+  for (i = 0; i < cs->nc; i++) {
+    for (j = i; j < cs->nc; j++) {
+      if (!ConfigsInteract(cfg[i], cfg[j]) ||
+	  !ConfigsInteract(cfg[j], cfg[i])) continue;
+      t = ((size_t) i)*cs->nc + j;
+      cs->map[t>>3] |= 1 << (t&7);
+      t = ((size_t) j)*cs->nc + i;
+      cs->map[t>>3] |= 1 << (t&7);
+    }
+  }
+  free(cfg);
+  return 0;
+}
+
+static int CompareStateKey(const void *p0, const void *p1) {
+  const int *k0, *k1;
+  int i;
+
+  k0 = (const int *) p0;
+  k1 = (const int *) p1;
+  for (i = 0; i < 3; i++) {
+    if (k0[i] < k1[i]) return -1;
+    if (k0[i] > k1[i]) return 1;
+  }
+  return 0;
+}
+
+static void FreeHamiltonReuse(void) {
+  int s, i;
+  HAMREUSE *hr;
+
+  if (_hreuse == NULL) return;
+  for (s = 0; s < MAX_SYMMETRIES; s++) {
+    hr = _hreuse + s;
+    if (hr->nb <= 0) continue;
+    for (i = 0; i < hr->nb; i++) {
+      if (hr->nr[i] > 0) {
+	free(hr->ir[i]);
+	free(hr->r[i]);
+      }
+    }
+    free(hr->ib);
+    free(hr->od);
+    free(hr->nr);
+    free(hr->ir);
+    free(hr->r);
+  }
+  free(_hreuse);
+  _hreuse = NULL;
+}
+
+/*
+** load the hamiltonians written by a previous run for reuse in the
+** construction of the current ones, so that only the elements involving
+** new states are computed when configuration groups are appended. the
+** old basis states are identified by (group name, config, csf) from the
+** key table at the end of the file. for files without it, the state
+** indices are assumed unchanged. the radial orbitals must be the same
+** as in the previous run.
+*/
+static int LoadHamiltonReuse(char *fn) {
+  int s, i, j, k, m, n, ng, dim, nb, t, *kg, **obs, *gmap, *key, ks[3];
+  int nsym, nold, nnew;
+  double r, *tr;
+  char gname[GROUP_NAME_LEN];
+  FILE *f;
+  HAMREUSE *hr;
+  SYMMETRY *sym;
+  STATE *st;
+
+  FreeHamiltonReuse();
+  f = fopen(fn, "r");
+  if (f == NULL) {
+    printf("cannot open file: %s\n", fn);
+    return -1;
+  }
+  fread(&n, sizeof(int), 1, f);
+  fread(&ng, sizeof(int), 1, f);
+  fseek(f, sizeof(int)*ng, SEEK_CUR);
+  fread(&ng, sizeof(int), 1, f);
+  if (ng > 0) fseek(f, sizeof(int)*ng, SEEK_CUR);
+  _hreuse = calloc(MAX_SYMMETRIES, sizeof(HAMREUSE));
+  obs = calloc(MAX_SYMMETRIES, sizeof(int *));
+  for (s = 0; s < MAX_SYMMETRIES; s++) {
+    if (fread(&k, sizeof(int), 1, f) != 1) break;
+    fread(&dim, sizeof(int), 1, f);
+    if (dim <= 0) continue;
+    hr = _hreuse + s;
+    fread(&k, sizeof(int), 1, f);
+    fread(&nb, sizeof(int), 1, f);
+    hr->nb = nb;
+    hr->nd = dim;
+    obs[s] = malloc(sizeof(int)*nb);
+    fread(obs[s], sizeof(int), nb, f);
+    hr->od = calloc(nb, sizeof(double));
+    hr->nr = calloc(nb, sizeof(int));
+    hr->ir = calloc(nb, sizeof(int *));
+    hr->r = calloc(nb, sizeof(double *));
+    fread(&n, sizeof(int), 1, f);
+    if (n < 0) {
+      hr->nd = nb;
+      hr->sp = 1;
+      fread(hr->od, sizeof(double), nb, f);
+      fread(hr->nr, sizeof(int), nb, f);
+      fseek(f, sizeof(int)*nb, SEEK_CUR);
+      for (i = 0; i < nb; i++) {
+	if (hr->nr[i] <= 0) continue;
+	hr->ir[i] = malloc(sizeof(int)*hr->nr[i]);
+	hr->r[i] = malloc(sizeof(double)*hr->nr[i]);
+	fread(hr->ir[i], sizeof(int), hr->nr[i], f);
+	fread(hr->r[i], sizeof(double), hr->nr[i], f);
+      }
+      continue;
+    }
+    /* dense records are in the order of increasing column in each row */
+    kg = malloc(sizeof(int)*n*2);
+    tr = malloc(sizeof(double)*n);
+    for (t = 0; t < n; t++) {
+      fread(&i, sizeof(int), 1, f);
+      fread(&j, sizeof(int), 1, f);
+      fread(&r, sizeof(double), 1, f);
+      kg[2*t] = i;
+      kg[2*t+1] = j;
+      tr[t] = r;
+      if (i == j) hr->od[i] = r;
+      else hr->nr[i]++;
+    }
+    for (i = 0; i < nb; i++) {
+      if (hr->nr[i] <= 0) continue;
+      hr->ir[i] = malloc(sizeof(int)*hr->nr[i]);
+      hr->r[i] = malloc(sizeof(double)*hr->nr[i]);
+      hr->nr[i] = 0;
+    }
+    for (t = 0; t < n; t++) {
+      i = kg[2*t];
+      j = kg[2*t+1];
+      if (i == j) continue;
+      hr->ir[i][hr->nr[i]] = j;
+      hr->r[i][hr->nr[i]] = tr[t];
+      hr->nr[i]++;
+    }
+    free(kg);
+    free(tr);
+  }
+  gmap = NULL;
+  if (fread(&ng, sizeof(int), 1, f) == 1 && ng > 0) {
+    gmap = malloc(sizeof(int)*ng);
+    for (i = 0; i < ng; i++) {
+      fread(gname, sizeof(char), GROUP_NAME_LEN, f);
+      gmap[i] = GroupExists(gname);
+    }
+  }
+  nsym = 0;
+  nold = 0;
+  nnew = 0;
+  for (s = 0; s < MAX_SYMMETRIES; s++) {
+    hr = _hreuse + s;
+    sym = GetSymmetry(s);
+    if (hr->nb > 0 && sym != NULL && sym->n_states > 0) {
+      hr->ns = sym->n_states;
+      hr->ib = malloc(sizeof(int)*hr->ns);
+      for (i = 0; i < hr->ns; i++) hr->ib[i] = -1;
+      if (gmap == NULL) {
+	for (i = 0; i < hr->nb; i++) {
+	  if (obs[s][i] < hr->ns) hr->ib[obs[s][i]] = i;
+	}
+      }
+    }
+  }
+  while (gmap && fread(&s, sizeof(int), 1, f) == 1) {
+    fread(&nb, sizeof(int), 1, f);
+    key = malloc(sizeof(int)*4*nb);
+    for (i = 0; i < nb; i++) {
+      fread(key+4*i, sizeof(int), 3, f);
+      m = key[4*i];
+      key[4*i] = (m >= 0 && m < ng)? gmap[m] : -1;
+      key[4*i+3] = i;
+    }
+    hr = _hreuse + s;
+    if (hr->ns > 0 && nb == hr->nb) {
+      qsort(key, nb, sizeof(int)*4, CompareStateKey);
+      sym = GetSymmetry(s);
+      for (t = 0; t < hr->ns; t++) {
+	st = (STATE *) ArrayGet(&(sym->states), t);
+	if (st->kgroup < 0) continue;
+	ks[0] = st->kgroup;
+	ks[1] = st->kcfg;
+	ks[2] = st->kstate;
+	kg = bsearch(ks, key, nb, sizeof(int)*4, CompareStateKey);
+	if (kg) hr->ib[t] = kg[3];
+      }
+    }
+    free(key);
+  }
+  fclose(f);
+  for (s = 0; s < MAX_SYMMETRIES; s++) {
+    hr = _hreuse + s;
+    if (obs[s]) free(obs[s]);
+    if (hr->nb <= 0) continue;
+    k = 0;
+    for (i = 0; i < hr->ns; i++) {
+      if (hr->ib[i] >= 0) k++;
+    }
+    if (k > 0) nsym++;
+    nold += k;
+    nnew += hr->ns;
+    if (k == 0) {
+      if (hr->ns > 0) free(hr->ib);
+      hr->ib = NULL;
+      hr->ns = 0;
+    }
+  }
+  free(obs);
+  if (gmap) free(gmap);
+  MPrintf(0, "ham_inc: %s %d symmetries, %d of %d states reused\n",
+	  fn, nsym, nold, nnew);
+  return 0;
+}
+
+static int ReusedElement(HAMREUSE *hr, int isi, int isj, double *r) {
+  int a, b, k;
+
+  if (isi >= hr->ns || isj >= hr->ns) return 0;
+  a = hr->ib[isi];
+  b = hr->ib[isj];
+  if (a < 0 || b < 0) return 0;
+  if (a == b) {
+    *r = hr->od[a];
+    return 1;
+  }
+  if (a > b) {
+    k = a;
+    a = b;
+    b = k;
+  }
+  if (a >= hr->nd) return 0;
+  k = IBisect(b, hr->nr[a], hr->ir[a]);
+  if (k < 0) {
+    /* a screened band element is not known to vanish */
+    if (hr->sp) return 0;
+    *r = 0.0;
+  } else {
+    *r = hr->r[a][k];
+  }
+  return 1;
+}
+
+static double HamiltonElementInc(int isym, int isi, int isj) {
+  double r;
+
+  if (ReusedElement(_hreuse+isym, isi, isj, &r)) return r;
+  return HamiltonElement(isym, isi, isj);
+}
+
+static long HamCacheSlot(HAMCACHE *c, unsigned long long k) {
+  long i;
+
+  i = (long) ((k*0x9E3779B97F4A7C15ULL) >> 17) & (c->m-1);
+  while (c->k[i] && c->k[i] != k) {
+    i = (i+1) & (c->m-1);
+  }
+  return i;
+}
+
+static unsigned long long HamCacheKey(int isi, int isj) {
+  if (isi > isj) {
+    int t = isi;
+    isi = isj;
+    isj = t;
+  }
+  return (((unsigned long long) (isi+1)) << 32) | ((unsigned long long) isj);
+}
+
+static void HamCacheAdd(HAMCACHE *c, int isi, int isj, double r) {
+  unsigned long long k, *k0;
+  double *r0;
+  long i, m0;
+
+  if (2*(c->n+1) > c->m) {
+    k0 = c->k;
+    r0 = c->r;
+    m0 = c->m;
+    c->m = m0 > 0? 2*m0 : 1024;
+    c->k = calloc(c->m, sizeof(unsigned long long));
+    c->r = malloc(sizeof(double)*c->m);
+    for (i = 0; i < m0; i++) {
+      if (k0[i]) {
+	long j = HamCacheSlot(c, k0[i]);
+	c->k[j] = k0[i];
+	c->r[j] = r0[i];
+      }
+    }
+    if (m0 > 0) {
+      free(k0);
+      free(r0);
+    }
+  }
+  k = HamCacheKey(isi, isj);
+  i = HamCacheSlot(c, k);
+  if (c->k[i] == 0) {
+    c->k[i] = k;
+    c->n++;
+  }
+  c->r[i] = r;
+}
+
+/*
+** record the elements of the current matrix of h before it is rebuilt.
+** the old exact rows are reused through h->oham, but the diagonal of the
+** perturbative states, some of which become exact, is recomputed.
+*/
+static void HamCacheFill(HAMILTON *h) {
+  HAMCACHE *c;
+  int i;
+  long t;
+
+  if (h->hsp || h->hamilton == NULL) return;
+  c = _hcache + h->pj;
+  t = ((long)h->dim*(h->dim+1))/2 + (long)h->dim*(h->n_basis-h->dim);
+  for (i = h->dim; i < h->n_basis; i++, t++) {
+    HamCacheAdd(c, h->basis[i], h->basis[i], h->hamilton[t]);
+  }
+}
+
+static void FreeHamCache(void) {
+  long i, n;
+
+  if (_hcache == NULL) return;
+  n = 0;
+  for (i = 0; i < MAX_SYMMETRIES; i++) {
+    if (_hcache[i].m > 0) {
+      n += _hcache[i].n;
+      free(_hcache[i].k);
+      free(_hcache[i].r);
+    }
+  }
+  MPrintf(-1, "perturb_cache: %ld elements\n", n);
+  free(_hcache);
+  _hcache = NULL;
+}
+
+static double HamiltonElementCache(int isym, int isi, int isj) {
+  HAMCACHE *c;
+  long i;
+
+  c = _hcache + isym;
+  i = HamCacheSlot(c, HamCacheKey(isi, isj));
+  if (c->k[i]) return c->r[i];
+  return _hcache_fhe(isym, isi, isj);
+}
+
 int ConstructHamilton(int isym, int k0, int k, int *kg,
 		      int kp, int *kgp, int md) {
   int i, j, j0, t, ti, jp, jd, m1, m2, m3, ip;
@@ -590,6 +1118,7 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
   STATE *s;
   SYMMETRY *sym;
   double r;
+  double (*fhe)(int, int, int);
 #if (FAC_DEBUG >= DEBUG_STRUCTURE)
   char name[LEVEL_NAME_LEN];
 #endif
@@ -688,10 +1217,18 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
       }
     }
   }
+  fhe = HamiltonElement;
+  if (_hreuse && _hreuse[isym].ns > 0) fhe = HamiltonElementInc;
+  if (_hcache && _hcache[isym].n > 0) {
+    _hcache_fhe = fhe;
+    fhe = HamiltonElementCache;
+  }
   if (m2 && !h->hsp) {
+    CFGSCREEN cs;
     for (j = 0; j < h->hsize; j++) {
       h->hamilton[j] = 0;
     }
+    InitConfigScreen(&cs, h);
     ResetWidMPI();
 #pragma omp parallel default(shared) private(i,j,t,r)
     {
@@ -713,6 +1250,7 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
 	}
 	for (i = 0; i <= j; i++) {
 	  if (i != j && i >= jd && j >= jd) r = 0;
+	  else if (ScreenedPair(&cs, i, j)) r = 0;
 	  else if (k0 < 0) {
 	    if (ip == 1) {
 	      if (i < h->odim) {
@@ -722,7 +1260,7 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
 		  r = h->oham[ot+i*(h->onbs-h->odim)+(kg[j]-h->odim)];
 		}
 	      } else {
-		r = HamiltonElement(isym, h->basis[i], h->basis[j]);
+		r = fhe(isym, h->basis[i], h->basis[j]);
 	      }
 	    } else if (ip == 2) {
 	      if (i < h->ondim && j < h->ondim) {
@@ -730,13 +1268,13 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
 	      } else if (i < h->ondim) {
 		r = h->oham[i+ti];
 	      } else {
-		r = HamiltonElement(isym, h->basis[i], h->basis[j]);
+		r = fhe(isym, h->basis[i], h->basis[j]);
 	      }
 	    }
 	  } else if (perturb_setzero == 2 && i != j && i >= j0 && j >= j0) {
 	    r = 0.0;
 	  } else {
-	    r = HamiltonElement(isym, h->basis[i], h->basis[j]);
+	    r = fhe(isym, h->basis[i], h->basis[j]);
 	  }
 	  h->hamilton[i+t] = r;
 	  //printf("ham: %d %d %d %d %d %g\n", h->pj, i, j, j0, h->dim, r);
@@ -756,6 +1294,10 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
 	    }
 	  }
 	  for (j = h->dim; j < h->n_basis; j++) {
+	    if (ScreenedPair(&cs, i, j)) {
+	      h->hamilton[t++] = 0;
+	      continue;
+	    }
 	    if (i < h->odim) {
 	      if (j < h->odim) {
 		r = h->oham[(j*(j+1))/2+i];
@@ -763,7 +1305,7 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
 		r = h->oham[ot+i*(h->onbs-h->odim)+(kgp[j-h->dim]-h->odim)];
 	      }
 	    } else {
-	      r = HamiltonElement(isym, h->basis[i], h->basis[j]);
+	      r = fhe(isym, h->basis[i], h->basis[j]);
 	    }
 	    h->hamilton[t++] = r;
 	  }
@@ -777,7 +1319,7 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
 	    t++;
 	    continue;
 	  }
-	  r = HamiltonElement(isym, h->basis[j], h->basis[j]);
+	  r = fhe(isym, h->basis[j], h->basis[j]);
 	  h->hamilton[t++] = r;
 	}
 	/*
@@ -792,9 +1334,10 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
 		    MPI_SUM, MPI_COMM_WORLD);
     }
 #endif
+    FreeConfigScreen(&cs);
   }
   if (m2 && h->hsp) {
-    ConstructHamiltonBand(h, HamiltonElement);
+    ConstructHamiltonBand(h, fhe);
   }
   if (m3) {
     if (nhams >= _max_hams) {
@@ -833,6 +1376,182 @@ int ConstructHamilton(int isym, int k0, int k, int *kg,
   return -1;
 }
 
+/*
+** with USE_MPI == 1, the rows of the band-screened hamiltonian are
+** computed round robin, row i on rank i%nproc. with diag_dist, they are
+** left there and the Davidson solver works on the distributed matrix,
+** otherwise each row is broadcast from its owner.
+*/
+static int HamiltonDistributed(HAMILTON *h) {
+#if USE_MPI == 1
+  return diag_dist && NProcMPI() > 1 &&
+    diag_nlev > 0 && diag_nlev < h->n_basis;
+#else
+  return 0;
+#endif
+}
+
+static int OwnHamiltonRow(HAMILTON *h, int i) {
+  int np, mr;
+
+  if (!h->hdist) return 1;
+  mr = MPIRank(&np);
+  return i%np == mr;
+}
+
+#if USE_MPI == 1
+static void BcastHamiltonRow(MATRIX *a, int i) {
+  int np, mr, k, nr[2];
+
+  mr = MPIRank(&np);
+  k = i%np;
+  nr[0] = a->nr[i];
+  nr[1] = a->nb[i];
+  MPI_Bcast(nr, 2, MPI_INT, k, MPI_COMM_WORLD);
+  if (k != mr) {
+    if (a->nr[i] > 0) {
+      free(a->ir[i]);
+      free(a->r[i]);
+    }
+    a->nr[i] = nr[0];
+    a->nb[i] = nr[1];
+    if (nr[0] <= 0) return;
+    a->ir[i] = malloc(sizeof(int)*nr[0]);
+    a->r[i] = malloc(sizeof(double)*nr[0]);
+  }
+  if (nr[0] <= 0) return;
+  MPI_Bcast(a->ir[i], nr[0], MPI_INT, k, MPI_COMM_WORLD);
+  MPI_Bcast(a->r[i], nr[0], MPI_DOUBLE, k, MPI_COMM_WORLD);
+}
+#endif
+
+/*
+** band-screened hamiltonians are stored row by row as in hsp. when read
+** into a dense hamiltonian, the couplings among the perturbers are
+** dropped, as in the dense record.
+*/
+static void WriteHamiltonSparse(FILE *f, HAMILTON *h) {
+  int i, n;
+  MATRIX *a = h->hsp;
+
+  n = -1;
+  fwrite(&n, sizeof(int), 1, f);
+  fwrite(a->d, sizeof(double), h->n_basis, f);
+  if (!h->hdist) {
+    fwrite(a->nr, sizeof(int), h->n_basis, f);
+  }
+  if (!h->hdist) {
+    fwrite(a->nb, sizeof(int), h->n_basis, f);
+    for (i = 0; i < h->n_basis; i++) {
+      if (a->nr[i] <= 0) continue;
+      fwrite(a->ir[i], sizeof(int), a->nr[i], f);
+      fwrite(a->r[i], sizeof(double), a->nr[i], f);
+    }
+    return;
+  }
+#if USE_MPI == 1
+  /* distributed rows are passed through one at a time */
+  int *nr, *nb, np, mr;
+  mr = MPIRank(&np);
+  nr = malloc(sizeof(int)*h->n_basis*2);
+  nb = nr + h->n_basis;
+  for (i = 0; i < h->n_basis; i++) {
+    nr[i] = a->nr[i];
+    nb[i] = a->nb[i];
+  }
+  MPI_Allreduce(MPI_IN_PLACE, nr, h->n_basis, MPI_INT,
+		MPI_SUM, MPI_COMM_WORLD);
+  MPI_Allreduce(MPI_IN_PLACE, nb, h->n_basis, MPI_INT,
+		MPI_MAX, MPI_COMM_WORLD);
+  fwrite(nr, sizeof(int), h->n_basis, f);
+  fwrite(nb, sizeof(int), h->n_basis, f);
+  for (i = 0; i < h->n_basis; i++) {
+    if (nr[i] <= 0) continue;
+    BcastHamiltonRow(a, i);
+    fwrite(a->ir[i], sizeof(int), a->nr[i], f);
+    fwrite(a->r[i], sizeof(double), a->nr[i], f);
+    if (i%np != mr) {
+      free(a->ir[i]);
+      free(a->r[i]);
+      a->ir[i] = NULL;
+      a->r[i] = NULL;
+      a->nr[i] = 0;
+      a->nb[i] = -1;
+    }
+  }
+  free(nr);
+#endif
+}
+
+static int ReadHamiltonSparse(FILE *f, HAMILTON *h) {
+  int i, j, k, m, *nr, *ir;
+  size_t t, t0, t1;
+  double *d, *r;
+
+  m = h->n_basis;
+  nr = malloc(sizeof(int)*m);
+  d = malloc(sizeof(double)*m);
+  fread(d, sizeof(double), m, f);
+  fread(nr, sizeof(int), m, f);
+  if (h->hsp) {
+    if (HamiltonDistributed(h)) h->hdist = 1;
+    memcpy(h->hsp->d, d, sizeof(double)*m);
+    memcpy(h->hsp->nr, nr, sizeof(int)*m);
+    fread(h->hsp->nb, sizeof(int), m, f);
+    for (i = 0; i < m; i++) {
+      if (nr[i] <= 0) continue;
+      if (!OwnHamiltonRow(h, i)) {
+	fseek(f, (sizeof(int)+sizeof(double))*nr[i], SEEK_CUR);
+	h->hsp->nr[i] = 0;
+	h->hsp->nb[i] = -1;
+	continue;
+      }
+      h->hsp->ir[i] = malloc(sizeof(int)*nr[i]);
+      h->hsp->r[i] = malloc(sizeof(double)*nr[i]);
+      fread(h->hsp->ir[i], sizeof(int), nr[i], f);
+      fread(h->hsp->r[i], sizeof(double), nr[i], f);
+    }
+    free(nr);
+    free(d);
+    return 0;
+  }
+  fseek(f, sizeof(int)*m, SEEK_CUR);
+  for (t = 0; t < h->hsize; t++) h->hamilton[t] = 0;
+  t0 = ((size_t)(h->dim+1))*h->dim/2;
+  t1 = t0 + ((size_t)h->dim)*(m-h->dim);
+  for (i = 0; i < m; i++) {
+    if (i < h->dim) {
+      t = ((size_t)(i+1))*i/2 + i;
+    } else {
+      t = t1 + i - h->dim;
+    }
+    h->hamilton[t] = d[i];
+  }
+  for (i = 0; i < m; i++) {
+    if (nr[i] <= 0) continue;
+    ir = malloc(sizeof(int)*nr[i]);
+    r = malloc(sizeof(double)*nr[i]);
+    fread(ir, sizeof(int), nr[i], f);
+    fread(r, sizeof(double), nr[i], f);
+    for (k = 0; k < nr[i]; k++) {
+      j = ir[k];
+      if (j < h->dim) {
+	t = ((size_t)(j+1))*j/2 + i;
+      } else if (i < h->dim) {
+	t = t0 + ((size_t)i)*(m-h->dim) + j-h->dim;
+      } else {
+	continue;
+      }
+      h->hamilton[t] = r[k];
+    }
+    free(ir);
+    free(r);
+  }
+  free(nr);
+  free(d);
+  return 0;
+}
+
 int ReadHamilton(char *fn, int *ng0, int *ng, int **kg,
 		 int *ngp, int **kgp, int md) {
   int s, i, j, t, n, k;
@@ -871,12 +1590,30 @@ int ReadHamilton(char *fn, int *ng0, int *ng, int **kg,
     fread(&h->orig_dim, sizeof(int), 1, f);
     fread(&h->n_basis, sizeof(int), 1, f);
     if (AllocHamMem(h, h->dim, h->n_basis) == -1) return -1;
-    for (t = 0; t < h->hsize; t++) h->hamilton[t] = 0;
+    if (!h->hsp) {
+      for (t = 0; t < h->hsize; t++) h->hamilton[t] = 0;
+    }
     fread(h->basis, sizeof(int), h->n_basis, f);
     fread(&n, sizeof(int), 1, f);
     //printf("rh: %d %d %d %d %d %d\n", s, k, h->dim, h->n_basis, h->hsize, n);
     long t0 = (h->dim+1)*(h->dim)/2;
     long t1 = t0 + h->dim*(h->n_basis-h->dim);
+    if (n < 0) {
+      if (ReadHamiltonSparse(f, h) < 0) {
+	fclose(f);
+	return -1;
+      }
+      if (md) {
+	ConstructHamilton(s, *ng0, *ng, *kg, *ngp, *kgp, 1);
+      }
+      continue;
+    }
+    if (h->hsp) {
+      printf("dense hamilton in %s cannot be read in band mode: %d\n",
+	     fn, s);
+      fclose(f);
+      return -1;
+    }
     for (k = 0; k < n; k++) {
       fread(&i, sizeof(int), 1, f);
       fread(&j, sizeof(int), 1, f);
@@ -903,6 +1640,8 @@ int WriteHamilton(char *fn, int ng0, int ng, int *kg, int ngp, int *kgp) {
   int s, i, j, t, n;
   FILE *f;
   HAMILTON *h;
+  SYMMETRY *sym;
+  STATE *st;
 
   f = fopen(fn, "w");
   if (f == NULL) return -1;
@@ -921,6 +1660,10 @@ int WriteHamilton(char *fn, int ng0, int ng, int *kg, int ngp, int *kgp) {
     fwrite(&h->orig_dim, sizeof(int), 1, f);
     fwrite(&h->n_basis, sizeof(int), 1, f);
     fwrite(h->basis, sizeof(int), h->n_basis, f);
+    if (h->hsp) {
+      WriteHamiltonSparse(f, h);
+      continue;
+    }
     n = 0;
     for (t = 0; t < h->hsize; t++) {
       if (fabs(h->hamilton[t]) > 1e-20) n++;
@@ -962,6 +1705,25 @@ int WriteHamilton(char *fn, int ng0, int ng, int *kg, int ngp, int *kgp) {
       }
     }
   }
+  /* state keys for the reuse in an extended run, see LoadHamiltonReuse */
+  n = GetNumGroups();
+  fwrite(&n, sizeof(int), 1, f);
+  for (i = 0; i < n; i++) {
+    fwrite(GetGroup(i)->name, sizeof(char), GROUP_NAME_LEN, f);
+  }
+  for (s = 0; s < MAX_SYMMETRIES; s++) {
+    h = GetHamilton(s);
+    if (h->dim <= 0) continue;
+    sym = GetSymmetry(s);
+    fwrite(&s, sizeof(int), 1, f);
+    fwrite(&h->n_basis, sizeof(int), 1, f);
+    for (i = 0; i < h->n_basis; i++) {
+      st = (STATE *) ArrayGet(&(sym->states), h->basis[i]);
+      fwrite(&st->kgroup, sizeof(int), 1, f);
+      fwrite(&st->kcfg, sizeof(int), 1, f);
+      fwrite(&st->kstate, sizeof(int), 1, f);
+    }
+  }
   fclose(f);
   return 0;
 }
@@ -1038,6 +1800,10 @@ int ValidBasisNK(STATE *s, int k, int *kg, int n1, int n0, int r1, int r0) {
 void ConstructHamiltonBand(HAMILTON *h, double (*fhe)(int, int, int)) {
   int i, j, t;
   double r;
+  CFGSCREEN cs;
+#if USE_MPI == 1
+  for (i = 0; i < h->n_basis; i++) h->work[i] = 0.0;
+#endif
   ResetWidMPI();
 #pragma omp parallel default(shared) private(i,j,t,r)
   {
@@ -1049,6 +1815,12 @@ void ConstructHamiltonBand(HAMILTON *h, double (*fhe)(int, int, int)) {
       h->work[i] = r;
     }
   }
+#if USE_MPI == 1
+  if (NProcMPI() > 1) {
+    MPI_Allreduce(MPI_IN_PLACE, h->work, h->n_basis, MPI_DOUBLE,
+		  MPI_SUM, MPI_COMM_WORLD);
+  }
+#endif
   ArgSort(h->n_basis, h->work, h->iwork);
   memcpy(h->iwork+h->n_basis, h->basis, sizeof(int)*h->n_basis);
   for (i = 0; i < h->n_basis; i++) {
@@ -1056,6 +1828,8 @@ void ConstructHamiltonBand(HAMILTON *h, double (*fhe)(int, int, int)) {
     h->hsp->d[i] = h->work[t];
     h->basis[i] = h->iwork[t+h->n_basis];
   }
+  cs.nc = 0;
+  if (fhe != HamiltonElementFBF) InitConfigScreen(&cs, h);
   ResetWidMPI();
 #pragma omp parallel default(shared) private(i, j, t, r)
   {
@@ -1069,6 +1843,7 @@ void ConstructHamiltonBand(HAMILTON *h, double (*fhe)(int, int, int)) {
       int nz = 0;
       double mar = 0.0, ar, de;
       for (j = i+1; j < h->n_basis; j++) {
+	if (ScreenedPair(&cs, i, j)) continue;
 	r = fhe(h->pj, h->basis[i], h->basis[j]);
 	if (1+r == 1) continue;
 	nz++;
@@ -1090,6 +1865,18 @@ void ConstructHamiltonBand(HAMILTON *h, double (*fhe)(int, int, int)) {
       //	printf("hf: %d %d %d %d %d %d %g\n", i, t, h->hsp->ir[i][t-1], h->hsp->nb[i], h->hsp->ir[i][h->hsp->nb[i]], h->hsp->ir[i][h->hsp->nb[i]]-i, h->hsp->d[i]);
     }
   }
+  FreeConfigScreen(&cs);
+#if USE_MPI == 1
+  if (NProcMPI() > 1) {
+    if (HamiltonDistributed(h)) {
+      h->hdist = 1;
+    } else {
+      for (i = 0; i < h->n_basis-1; i++) {
+	BcastHamiltonRow(h->hsp, i);
+      }
+    }
+  }
+#endif
 }
 
 int ConstructHamiltonFrozen(int isym, int k, int *kg, int n, int snc,
@@ -2242,6 +3029,24 @@ int TestHamilton(void) {
   return 0;
 }
 
+/*
+** packed symmetric eigenproblem. the divide-and-conquer DSPEVD is used
+** for n >= diag_dcmin, its workspace is h->work/h->iwork, sized in
+** AllocHamMem to at least 1+6n+n*n and 3+5n. DSPEV is used when lwork
+** does not fit the int argument of DSPEVD.
+*/
+static void SymEigen(HAMILTON *h, char *jobz, char *uplo, int n,
+		     double *ap, double *w, double *z, double *work,
+		     int *info) {
+  if (diag_dcmin > 0 && n >= diag_dcmin &&
+      h->lwork <= INT_MAX && h->liwork <= INT_MAX) {
+    DSPEVD(jobz, uplo, n, ap, w, z, n, work, (int) h->lwork,
+	   h->iwork, (int) h->liwork, info);
+  } else {
+    DSPEV(jobz, uplo, n, ap, w, z, n, work, info);
+  }
+}
+
 void GenEigen(HAMILTON *h, char *trans, char *jobz, int n, double *ap,
 	      double *w, double *wi, double *z,
 	      double *work, int lwork, int *info) {
@@ -2271,7 +3076,7 @@ void GenEigen(HAMILTON *h, char *trans, char *jobz, int n, double *ap,
     }
   }
 
-  DSPEV(jobz, uplo, n, wi, w, z, n, work, info);  
+  SymEigen(h, jobz, uplo, n, wi, w, z, work, info);
   if (*info) {
     MPrintf(-1, "DSPEV ERROR in GenEigen: %d\n", *info);
     return;
@@ -2352,6 +3157,615 @@ void GenEigen(HAMILTON *h, char *trans, char *jobz, int n, double *ap,
   }
 }
 
+/*
+** y = H x for the symmetric band-screened hamiltonian stored in hsp,
+** which holds only the upper triangle. for a distributed hsp, each
+** rank adds the products of its own rows and the sum is reduced.
+*/
+static void HamiltonMatVec(HAMILTON *h, double *x, double *y) {
+  MATRIX *a = h->hsp;
+  int i, j, t;
+  double r;
+
+  for (i = 0; i < a->n; i++) {
+    if (OwnHamiltonRow(h, i)) y[i] = a->d[i]*x[i];
+    else y[i] = 0.0;
+  }
+  for (i = 0; i < a->n; i++) {
+    for (j = 0; j < a->nr[i]; j++) {
+      t = a->ir[i][j];
+      r = a->r[i][j];
+      y[i] += r*x[t];
+      y[t] += r*x[i];
+    }
+  }
+#if USE_MPI == 1
+  if (h->hdist) {
+    MPI_Allreduce(MPI_IN_PLACE, y, a->n, MPI_DOUBLE,
+		  MPI_SUM, MPI_COMM_WORLD);
+  }
+#endif
+}
+
+/*
+** block Davidson iterations for the lowest diag_nlev eigenpairs of hsp,
+** with the diagonal preconditioner and thick restart on the Ritz vectors.
+** the basis is sorted by the diagonal elements in ConstructHamiltonBand,
+** so the unit vectors of the first nev states are the starting guess.
+** if diag_emax > 0, only the levels within diag_emax of the lowest one
+** are kept. on return h->dim is the number of levels, and h->mixing
+** has the same layout as the full diagonalization.
+*/
+static int DavidsonHamilton(HAMILTON *h) {
+  MATRIX *a = h->hsp;
+  int m, nev, msub, k, k0, ntar, nadd, iter, i, j, t, p, info;
+  double *v, *av, *x, *ax, *s, *sp, *th, *y, *work, *u;
+  double r, de, rmax;
+  char jobz[] = "V";
+  char uplo[] = "U";
+
+  m = h->n_basis;
+  nev = Min(diag_nlev, m);
+  msub = Min(m, Max(3*nev, nev+32));
+  v = malloc(sizeof(double)*m*msub);
+  av = malloc(sizeof(double)*m*msub);
+  x = malloc(sizeof(double)*m*nev);
+  ax = malloc(sizeof(double)*m*nev);
+  s = malloc(sizeof(double)*msub*msub);
+  sp = malloc(sizeof(double)*msub*(msub+1)/2);
+  th = malloc(sizeof(double)*msub);
+  y = malloc(sizeof(double)*msub*msub);
+  work = malloc(sizeof(double)*3*msub);
+
+  for (i = 0; i < m*nev; i++) v[i] = 0.0;
+  for (i = 0; i < nev; i++) {
+    v[i*m+i] = 1.0;
+    HamiltonMatVec(h, v+i*m, av+i*m);
+  }
+  k = nev;
+  k0 = 0;
+  ntar = nev;
+  rmax = 0.0;
+  for (iter = 0; iter < diag_dmaxiter; iter++) {
+    for (j = k0; j < k; j++) {
+      for (i = 0; i <= j; i++) {
+	r = 0.0;
+	for (t = 0; t < m; t++) {
+	  r += v[i*m+t]*av[j*m+t];
+	}
+	s[i*msub+j] = r;
+	s[j*msub+i] = r;
+      }
+    }
+    t = 0;
+    for (j = 0; j < k; j++) {
+      for (i = 0; i <= j; i++) {
+	sp[t++] = s[i*msub+j];
+      }
+    }
+    DSPEV(jobz, uplo, k, sp, th, y, k, work, &info);
+    if (info) {
+      MPrintf(-1, "DSPEV ERROR in Davidson: %d %d %d\n", h->pj, k, info);
+      goto ERROR;
+    }
+    ntar = nev;
+    if (diag_emax > 0) {
+      for (i = 1; i < nev; i++) {
+	if (th[i] > th[0] + diag_emax) break;
+      }
+      ntar = i;
+    }
+    for (i = 0; i < nev; i++) {
+      u = x + i*m;
+      for (t = 0; t < m; t++) {
+	u[t] = 0.0;
+	ax[i*m+t] = 0.0;
+      }
+      for (j = 0; j < k; j++) {
+	r = y[i*k+j];
+	for (t = 0; t < m; t++) {
+	  u[t] += r*v[j*m+t];
+	  ax[i*m+t] += r*av[j*m+t];
+	}
+      }
+    }
+    if (k + ntar > msub) {
+      memcpy(v, x, sizeof(double)*m*nev);
+      memcpy(av, ax, sizeof(double)*m*nev);
+      for (i = 0; i < nev; i++) {
+	for (j = 0; j < nev; j++) {
+	  s[i*msub+j] = 0.0;
+	}
+	s[i*msub+i] = th[i];
+      }
+      k = nev;
+    }
+    k0 = k;
+    nadd = 0;
+    rmax = 0.0;
+    for (i = 0; i < ntar && k < msub; i++) {
+      u = v + k*m;
+      r = 0.0;
+      for (t = 0; t < m; t++) {
+	u[t] = ax[i*m+t] - th[i]*x[i*m+t];
+	r += u[t]*u[t];
+      }
+      r = sqrt(r);
+      if (r > rmax) rmax = r;
+      if (r < diag_dtol) continue;
+      for (t = 0; t < m; t++) {
+	de = th[i] - a->d[t];
+	if (fabs(de) < EPS8) de = de < 0? -EPS8:EPS8;
+	u[t] /= de;
+      }
+      for (p = 0; p < 2; p++) {
+	for (j = 0; j < k; j++) {
+	  r = 0.0;
+	  for (t = 0; t < m; t++) {
+	    r += v[j*m+t]*u[t];
+	  }
+	  for (t = 0; t < m; t++) {
+	    u[t] -= r*v[j*m+t];
+	  }
+	}
+      }
+      r = 0.0;
+      for (t = 0; t < m; t++) {
+	r += u[t]*u[t];
+      }
+      r = sqrt(r);
+      if (r < EPS10) continue;
+      for (t = 0; t < m; t++) {
+	u[t] /= r;
+      }
+      HamiltonMatVec(h, u, av+k*m);
+      k++;
+      nadd++;
+    }
+    if (nadd == 0) break;
+  }
+  if (rmax >= diag_dtol) {
+    MPrintf(-1, "Davidson not converged: %d %d %d %d %g\n",
+	    h->pj, m, ntar, iter, rmax);
+  }
+  h->dim = ntar;
+  h->diag_iter = iter;
+  h->diag_etol = rmax;
+  h->diag_emin = th[0];
+  for (i = 0; i < ntar; i++) {
+    h->mixing[i] = th[i];
+  }
+  memcpy(h->mixing+ntar, x, sizeof(double)*m*ntar);
+  free(v);
+  free(av);
+  free(x);
+  free(ax);
+  free(s);
+  free(sp);
+  free(th);
+  free(y);
+  free(work);
+  return 0;
+
+ ERROR:
+  free(v);
+  free(av);
+  free(x);
+  free(ax);
+  free(s);
+  free(sp);
+  free(th);
+  free(y);
+  free(work);
+  return -1;
+}
+
+/*
+** the Davidson iterations of DavidsonHamilton with the subspace in single
+** precision, for the shifted matrix H-d[0] so that the Ritz values do not
+** lose the digits of the total energy. the matrix-vector products, the
+** projections and the corrections are done in double. the Ritz pairs are
+** stored in h->mixing as by DavidsonHamilton.
+*/
+static int DavidsonHamiltonF(HAMILTON *h, double tol) {
+  MATRIX *a = h->hsp;
+  int m, nev, msub, k, k0, ntar, nadd, iter, i, j, t, p, info;
+  float *v, *av, *x, *ax, *f;
+  double *s, *sp, *th, *y, *work, *u, *w;
+  double r, de, rmax, e0;
+  char jobz[] = "V";
+  char uplo[] = "U";
+
+  m = h->n_basis;
+  nev = Min(diag_nlev, m);
+  e0 = a->d[0];
+  msub = Min(m, Max(3*nev, nev+32));
+  v = malloc(sizeof(float)*m*msub);
+  av = malloc(sizeof(float)*m*msub);
+  x = malloc(sizeof(float)*m*nev);
+  ax = malloc(sizeof(float)*m*nev);
+  u = malloc(sizeof(double)*m);
+  w = malloc(sizeof(double)*m);
+  s = malloc(sizeof(double)*msub*msub);
+  sp = malloc(sizeof(double)*msub*(msub+1)/2);
+  th = malloc(sizeof(double)*msub);
+  y = malloc(sizeof(double)*msub*msub);
+  work = malloc(sizeof(double)*3*msub);
+
+  for (t = 0; t < m; t++) u[t] = 0.0;
+  for (i = 0; i < m*nev; i++) v[i] = 0.0;
+  for (i = 0; i < nev; i++) {
+    v[i*m+i] = 1.0;
+    u[i] = 1.0;
+    HamiltonMatVec(h, u, w);
+    u[i] = 0.0;
+    w[i] -= e0;
+    f = av + i*m;
+    for (t = 0; t < m; t++) f[t] = w[t];
+  }
+  k = nev;
+  k0 = 0;
+  ntar = nev;
+  rmax = 0.0;
+  for (iter = 0; iter < diag_dmaxiter; iter++) {
+    for (j = k0; j < k; j++) {
+      for (i = 0; i <= j; i++) {
+	r = 0.0;
+	for (t = 0; t < m; t++) {
+	  r += (double)v[i*m+t]*av[j*m+t];
+	}
+	s[i*msub+j] = r;
+	s[j*msub+i] = r;
+      }
+    }
+    t = 0;
+    for (j = 0; j < k; j++) {
+      for (i = 0; i <= j; i++) {
+	sp[t++] = s[i*msub+j];
+      }
+    }
+    DSPEV(jobz, uplo, k, sp, th, y, k, work, &info);
+    if (info) {
+      MPrintf(-1, "DSPEV ERROR in Davidson: %d %d %d\n", h->pj, k, info);
+      goto ERROR;
+    }
+    ntar = nev;
+    if (diag_emax > 0) {
+      for (i = 1; i < nev; i++) {
+	if (th[i] > th[0] + diag_emax) break;
+      }
+      ntar = i;
+    }
+    for (i = 0; i < nev; i++) {
+      for (t = 0; t < m; t++) {
+	u[t] = 0.0;
+	w[t] = 0.0;
+      }
+      for (j = 0; j < k; j++) {
+	r = y[i*k+j];
+	for (t = 0; t < m; t++) {
+	  u[t] += r*v[j*m+t];
+	  w[t] += r*av[j*m+t];
+	}
+      }
+      for (t = 0; t < m; t++) {
+	x[i*m+t] = u[t];
+	ax[i*m+t] = w[t];
+      }
+    }
+    if (k + ntar > msub) {
+      memcpy(v, x, sizeof(float)*m*nev);
+      memcpy(av, ax, sizeof(float)*m*nev);
+      for (i = 0; i < nev; i++) {
+	for (j = 0; j < nev; j++) {
+	  s[i*msub+j] = 0.0;
+	}
+	s[i*msub+i] = th[i];
+      }
+      k = nev;
+    }
+    k0 = k;
+    nadd = 0;
+    rmax = 0.0;
+    for (i = 0; i < ntar && k < msub; i++) {
+      r = 0.0;
+      for (t = 0; t < m; t++) {
+	u[t] = ax[i*m+t] - th[i]*x[i*m+t];
+	r += u[t]*u[t];
+      }
+      r = sqrt(r);
+      if (r > rmax) rmax = r;
+      if (r < tol) continue;
+      for (t = 0; t < m; t++) {
+	de = th[i] - (a->d[t]-e0);
+	if (fabs(de) < EPS8) de = de < 0? -EPS8:EPS8;
+	u[t] /= de;
+      }
+      for (p = 0; p < 2; p++) {
+	for (j = 0; j < k; j++) {
+	  r = 0.0;
+	  for (t = 0; t < m; t++) {
+	    r += v[j*m+t]*u[t];
+	  }
+	  for (t = 0; t < m; t++) {
+	    u[t] -= r*v[j*m+t];
+	  }
+	}
+      }
+      r = 0.0;
+      for (t = 0; t < m; t++) {
+	r += u[t]*u[t];
+      }
+      r = sqrt(r);
+      if (r < EPS10) continue;
+      f = v + k*m;
+      for (t = 0; t < m; t++) {
+	u[t] /= r;
+	f[t] = u[t];
+      }
+      HamiltonMatVec(h, u, w);
+      f = av + k*m;
+      for (t = 0; t < m; t++) {
+	f[t] = w[t] - e0*u[t];
+      }
+      k++;
+      nadd++;
+    }
+    if (nadd == 0) break;
+  }
+  h->dim = ntar;
+  h->diag_iter = iter;
+  h->diag_etol = rmax;
+  h->diag_emin = th[0] + e0;
+  for (i = 0; i < ntar; i++) {
+    h->mixing[i] = th[i] + e0;
+  }
+  for (i = 0; i < m*ntar; i++) {
+    h->mixing[ntar+i] = x[i];
+  }
+  free(v);
+  free(av);
+  free(x);
+  free(ax);
+  free(u);
+  free(w);
+  free(s);
+  free(sp);
+  free(th);
+  free(y);
+  free(work);
+  return 0;
+
+ ERROR:
+  free(v);
+  free(av);
+  free(x);
+  free(ax);
+  free(u);
+  free(w);
+  free(s);
+  free(sp);
+  free(th);
+  free(y);
+  free(work);
+  return -1;
+}
+
+/*
+** refine the eigenpairs in h->mixing in double precision one at a time,
+** by Davidson iterations with the Olsen correction in a subspace of at
+** most nsub vectors, deflated against the pairs already refined.
+** returns the largest residual, or -1 on error or when the correction
+** vector falls into the subspace before convergence.
+*/
+static double RefineDavidson(HAMILTON *h, int nsub, int maxiter) {
+  MATRIX *a = h->hsp;
+  int m, n, i, j, k, t, p, q, iter, info, nit;
+  double *x, *v, *av, *s, *sp, *th, *y, *work, *u, *w, *c, *z, *az;
+  double r, de, e1, e2, rmax;
+  char jobz[] = "V";
+  char uplo[] = "U";
+
+  m = h->n_basis;
+  n = h->dim;
+  x = h->mixing + n;
+  v = malloc(sizeof(double)*m*nsub);
+  av = malloc(sizeof(double)*m*nsub);
+  u = malloc(sizeof(double)*m);
+  w = malloc(sizeof(double)*m);
+  c = malloc(sizeof(double)*m);
+  z = malloc(sizeof(double)*m);
+  az = malloc(sizeof(double)*m);
+  s = malloc(sizeof(double)*nsub*nsub);
+  sp = malloc(sizeof(double)*nsub*(nsub+1)/2);
+  th = malloc(sizeof(double)*nsub);
+  y = malloc(sizeof(double)*nsub*nsub);
+  work = malloc(sizeof(double)*3*nsub);
+  rmax = 0.0;
+  nit = 0;
+  for (i = 0; i < n; i++) {
+    memcpy(c, x+i*m, sizeof(double)*m);
+    k = 0;
+    for (iter = 0; iter < maxiter; iter++) {
+      for (q = 0; q < 2; q++) {
+	for (j = 0; j < i; j++) {
+	  r = 0.0;
+	  for (t = 0; t < m; t++) {
+	    r += x[j*m+t]*c[t];
+	  }
+	  for (t = 0; t < m; t++) {
+	    c[t] -= r*x[j*m+t];
+	  }
+	}
+	for (j = 0; j < k; j++) {
+	  r = 0.0;
+	  for (t = 0; t < m; t++) {
+	    r += v[j*m+t]*c[t];
+	  }
+	  for (t = 0; t < m; t++) {
+	    c[t] -= r*v[j*m+t];
+	  }
+	}
+      }
+      r = 0.0;
+      for (t = 0; t < m; t++) {
+	r += c[t]*c[t];
+      }
+      r = sqrt(r);
+      if (r < EPS10) {
+	if (k == 0) break;
+	rmax = -1;
+	goto DONE;
+      }
+      if (k == nsub) {
+	for (t = 0; t < m; t++) {
+	  z[t] = 0.0;
+	  az[t] = 0.0;
+	}
+	for (j = 0; j < k; j++) {
+	  r = y[k+j];
+	  for (t = 0; t < m; t++) {
+	    z[t] += r*v[j*m+t];
+	    az[t] += r*av[j*m+t];
+	  }
+	}
+	memcpy(v, u, sizeof(double)*m);
+	memcpy(av, w, sizeof(double)*m);
+	memcpy(v+m, z, sizeof(double)*m);
+	memcpy(av+m, az, sizeof(double)*m);
+	s[0] = th[0];
+	s[1] = 0.0;
+	s[nsub] = 0.0;
+	s[nsub+1] = th[1];
+	k = 2;
+	for (q = 0; q < 2; q++) {
+	  for (j = 0; j < k; j++) {
+	    r = 0.0;
+	    for (t = 0; t < m; t++) {
+	      r += v[j*m+t]*c[t];
+	    }
+	    for (t = 0; t < m; t++) {
+	      c[t] -= r*v[j*m+t];
+	    }
+	  }
+	}
+	r = 0.0;
+	for (t = 0; t < m; t++) {
+	  r += c[t]*c[t];
+	}
+	r = sqrt(r);
+	if (r < EPS10) {
+	  rmax = -1;
+	  goto DONE;
+	}
+      }
+      for (t = 0; t < m; t++) {
+	v[k*m+t] = c[t]/r;
+      }
+      HamiltonMatVec(h, v+k*m, av+k*m);
+      for (j = 0; j <= k; j++) {
+	r = 0.0;
+	for (t = 0; t < m; t++) {
+	  r += v[j*m+t]*av[k*m+t];
+	}
+	s[j*nsub+k] = r;
+	s[k*nsub+j] = r;
+      }
+      k++;
+      t = 0;
+      for (j = 0; j < k; j++) {
+	for (p = 0; p <= j; p++) {
+	  sp[t++] = s[p*nsub+j];
+	}
+      }
+      DSPEV(jobz, uplo, k, sp, th, y, k, work, &info);
+      if (info) {
+	MPrintf(-1, "DSPEV ERROR in RefineDavidson: %d %d %d\n",
+		h->pj, k, info);
+	rmax = -1;
+	goto DONE;
+      }
+      for (t = 0; t < m; t++) {
+	u[t] = 0.0;
+	w[t] = 0.0;
+      }
+      for (j = 0; j < k; j++) {
+	r = y[j];
+	for (t = 0; t < m; t++) {
+	  u[t] += r*v[j*m+t];
+	  w[t] += r*av[j*m+t];
+	}
+      }
+      r = 0.0;
+      for (t = 0; t < m; t++) {
+	c[t] = w[t] - th[0]*u[t];
+	r += c[t]*c[t];
+      }
+      r = sqrt(r);
+      if (r < diag_dtol) break;
+      e1 = 0.0;
+      e2 = 0.0;
+      for (t = 0; t < m; t++) {
+	de = th[0] - a->d[t];
+	if (fabs(de) < EPS8) de = de < 0? -EPS8:EPS8;
+	c[t] /= de;
+	e1 += u[t]*c[t];
+	e2 += u[t]*u[t]/de;
+      }
+      e1 /= e2;
+      for (t = 0; t < m; t++) {
+	de = th[0] - a->d[t];
+	if (fabs(de) < EPS8) de = de < 0? -EPS8:EPS8;
+	c[t] -= e1*u[t]/de;
+      }
+    }
+    nit += iter;
+    if (k == 0) {
+      rmax = 1.0;
+      break;
+    }
+    if (r > rmax) rmax = r;
+    memcpy(x+i*m, u, sizeof(double)*m);
+    h->mixing[i] = th[0];
+  }
+  h->diag_iter += nit;
+  h->diag_etol = rmax;
+  h->diag_emin = h->mixing[0];
+
+ DONE:
+  free(v);
+  free(av);
+  free(u);
+  free(w);
+  free(c);
+  free(z);
+  free(az);
+  free(s);
+  free(sp);
+  free(th);
+  free(y);
+  free(work);
+  return rmax;
+}
+
+/*
+** mixed precision Davidson. the single precision iterations converge to
+** diag_ftol, then each eigenpair is refined in double against hsp with at
+** most diag_rmaxiter steps in a subspace of diag_rnsub vectors. if that
+** does not reach diag_dtol, the full double precision iterations are done.
+*/
+static int DavidsonHamiltonMixed(HAMILTON *h) {
+  double r;
+
+  if (DavidsonHamiltonF(h, Max(diag_ftol, diag_dtol)) == 0) {
+    r = RefineDavidson(h, Max(diag_rnsub, 3), diag_rmaxiter);
+    if (r >= 0 && r < diag_dtol) return 0;
+    MPrintf(-1, "Davidson refinement stalled: %d %d %d %g\n",
+	    h->pj, h->n_basis, h->diag_iter, r);
+  }
+  return DavidsonHamilton(h);
+}
+
 /*
 ** be careful that the h->hamilton or h->heff is overwritten
 ** after the DiagnolizeHamilton call
@@ -2365,7 +3779,6 @@ int DiagnolizeHamilton(HAMILTON *h) {
   char uplo[] = "U";
   char trans[] = "N";
   int n, m, np;
-  int ldz;
   size_t lwork;
   int liwork, *ib;
   int info;
@@ -2380,7 +3793,6 @@ int DiagnolizeHamilton(HAMILTON *h) {
   n = h->dim;
   m = h->n_basis;
   np = m - n;
-  ldz = n;
   t0 = n*(n+1);
 
   lwork = h->lwork;
@@ -2399,6 +3811,10 @@ int DiagnolizeHamilton(HAMILTON *h) {
   }
 
   if (h->hsp) {
+    if (diag_nlev > 0 && diag_nlev < m) {
+      if (diag_mixed) return DavidsonHamiltonMixed(h);
+      return DavidsonHamilton(h);
+    }
     w = h->mixing;
     mixing = w+m;
     np = 0;
@@ -2626,7 +4042,7 @@ int DiagnolizeHamilton(HAMILTON *h) {
 
   if (h->heff == NULL) {
     if (m <= n) {
-      DSPEV(jobz, uplo, n, ap, w, z, ldz, h->work, &info);
+      SymEigen(h, jobz, uplo, n, ap, w, z, h->work, &info);
       if (info) {
 	MPrintf(-1, "DSPEV ERROR: %d %d %d\n", h->pj, h->perturb_iter, info);
 	goto ERROR;
@@ -3609,20 +5025,136 @@ int SolveStructureFrozen(char *fn, int ng, int *kg, int nc, int *kc,
   for (i = 0; i < MAX_SYMMETRIES; i++) {
     double wt0 = WallTime();
     h = GetHamilton(i);
-    if (h->dim <= 0) continue;
-    int skip = SkipMPI();
-    if (skip) continue;
-    DiagnolizeHamilton(h);
-    AddToLevels(h, 0, kg);
-    double wt1 = WallTime();
-    MPrintf(-1, "diagonalize hamilton: %d %d %g\n", i, h->dim, wt1-wt0);
-    fflush(stdout);
+    if (h->dim <= 0) continue;
+    int skip = SkipMPI();
+    if (skip) continue;
+    DiagnolizeHamilton(h);
+    AddToLevels(h, 0, kg);
+    double wt1 = WallTime();
+    MPrintf(-1, "diagonalize hamilton: %d %d %g\n", i, h->dim, wt1-wt0);
+    fflush(stdout);
+  }
+  }
+  
+  SortLevels(nlevels, -1, 0);
+  SaveLevels(fn, nlevels, -1);
+  return 0;
+}
+
+/*
+** symmetries in the order of decreasing cost, d^p with d the hamilton
+** dimension, or the estimate nb when given.
+*/
+static void SortHamiltonCost(int ns, int *iso, int *nb, int p) {
+  int i;
+  double c[MAX_SYMMETRIES];
+
+  for (i = 0; i < ns; i++) {
+    if (nb) c[i] = nb[i];
+    else c[i] = GetHamilton(i)->dim;
+    c[i] = -pow(Max(c[i], 0.0), p);
+  }
+  ArgSort(ns, c, iso);
+}
+
+/*
+** construct the hamiltonians of all symmetries. blocks with fewer than
+** sched_nmin basis states are built and diagonalized one per thread,
+** the larger ones are then built in the order of decreasing size with
+** the whole team. the hamiltons are registered afterwards in symmetry
+** order as before. dgs[i] is set to 1 (-1) for the blocks already
+** (un)successfully diagonalized. with ci_level -1 the blocks are diagonal
+** and registered while built, so they are built in symmetry order.
+*/
+static void ConstructHamiltonSched(int ns, int ng0, int ng, int *kg,
+				   int ngp, int *kgp, int md, int *dgs) {
+  int i, t, md0, md3, nb[MAX_SYMMETRIES], iso[MAX_SYMMETRIES];
+  int ks[MAX_SYMMETRIES];
+  SYMMETRY *sym;
+  STATE *s;
+  HAMILTON *h;
+
+  for (i = 0; i < ns; i++) dgs[i] = 0;
+  if (ci_level == -1) {
+    for (i = 0; i < ns; i++) {
+      t = ConstructHamilton(i, ng0, ng, kg, ngp, kgp, md);
+      h = GetHamilton(i);
+      h->orig_dim = h->dim;
+      h->exp_dim = 0;
+      if (t < 0) {
+	AllocHamMem(h, -1, -1);
+	AllocHamMem(h, 0, 0);
+      }
+    }
+    return;
+  }
+  /* md0 builds without registering, md3 only registers */
+  md0 = md - md%10;
+  md3 = (md/1000)*1000 + md%10;
+  for (i = 0; i < ns; i++) {
+    ks[i] = -1;
+    nb[i] = 0;
+    sym = GetSymmetry(i);
+    if (sym == NULL) continue;
+    for (t = 0; t < sym->n_states; t++) {
+      s = (STATE *) ArrayGet(&(sym->states), t);
+      if (InGroups(s->kgroup, ng, kg) ||
+	  (ngp > 0 && InGroups(s->kgroup, ngp, kgp))) {
+	nb[i]++;
+      }
+    }
+  }
+  SortHamiltonCost(ns, iso, nb, 2);
+#if USE_MPI == 2
+  if (sched_nmin > 0 && NProcMPI() > 1) {
+    ResetWidMPI();
+#pragma omp parallel default(shared) private(i, t, h)
+    {
+      MPID *pd = DataMPI();
+      int np = pd->nproc;
+      int k;
+      long long wid;
+      for (t = 0; t < ns; t++) {
+	i = iso[t];
+	if (nb[i] <= 0 || nb[i] >= sched_nmin) continue;
+	if (SkipMPI()) continue;
+	wid = pd->wid;
+	pd->nproc = 1;
+	k = ConstructHamilton(i, ng0, ng, kg, ngp, kgp, md0);
+	h = GetHamilton(i);
+	h->orig_dim = h->dim;
+	h->exp_dim = 0;
+	if (k >= 0) {
+	  dgs[i] = DiagnolizeHamilton(h) < 0 ? -1 : 1;
+	}
+	pd->nproc = np;
+	pd->wid = wid;
+	ks[i] = k;
+      }
+    }
+    for (i = 0; i < ns; i++) {
+      if (nb[i] > 0 && nb[i] < sched_nmin) nb[i] = -1;
+    }
+  }
+#endif
+  for (t = 0; t < ns; t++) {
+    i = iso[t];
+    if (nb[i] < 0) continue;
+    ks[i] = ConstructHamilton(i, ng0, ng, kg, ngp, kgp, md0);
+    h = GetHamilton(i);
+    h->orig_dim = h->dim;
+    h->exp_dim = 0;
   }
+  for (i = 0; i < ns; i++) {
+    h = GetHamilton(i);
+    if (ks[i] < 0) {
+      AllocHamMem(h, -1, -1);
+      AllocHamMem(h, 0, 0);
+      dgs[i] = 0;
+    } else if (md%10) {
+      ConstructHamilton(i, ng0, ng, kg, ngp, kgp, md3);
+    }
   }
-  
-  SortLevels(nlevels, -1, 0);
-  SaveLevels(fn, nlevels, -1);
-  return 0;
 }
 
 int SolveStructure(char *fn, char *hfn,
@@ -3670,30 +5202,31 @@ int SolveStructure(char *fn, char *hfn,
     AddToLevels(NULL, ng0, kg);
   } else {
     double wtb = WallTime();
+    int iso[MAX_SYMMETRIES], dgs[MAX_SYMMETRIES];
+    for (i = 0; i < ns; i++) dgs[i] = 0;
     if (rh == 0) {
-      for (i = 0; i < ns; i++) {
-	k = ConstructHamilton(i, ng0, ng, kg, ngp, kgp, md);
-	h = GetHamilton(i);
-	h->orig_dim = h->dim;
-	h->exp_dim = 0;
-	if (k < 0) {
-	  h = GetHamilton(i);
-	  AllocHamMem(h, -1, -1);
-	  AllocHamMem(h, 0, 0);
-	}
-      }
+      if (ham_inc[0]) LoadHamiltonReuse(ham_inc);
+      ConstructHamiltonSched(ns, ng0, ng, kg, ngp, kgp, md, dgs);
+    }
+    SortHamiltonCost(ns, iso, NULL, 3);
+    for (i = 0; i < ns; i++) {
+      GetHamilton(i)->diag_rank = -1;
     }
     ResetWidMPI();
-#pragma omp parallel default(shared) private(i, h)
+#pragma omp parallel default(shared) private(i, k, h)
     {
-      for (i = 0; i < ns; i++) {
+      for (k = 0; k < ns; k++) {
+	i = iso[k];
 	h = GetHamilton(i);
 	if (h->dim <= 0) continue;
 	int skip = SkipMPI();
-	if (skip) continue;
-	if (DiagnolizeHamilton(h) < 0) {
+	if (skip && !h->hdist) continue;
+	if (dgs[i] < 0) continue;
+	if (dgs[i] == 0 && DiagnolizeHamilton(h) < 0) {
 	  continue;
 	}
+	/* the rank holding the mixing of this symmetry */
+	h->diag_rank = MyRankMPI();
 	if (fn != NULL) {
 	  if (ip == 0 || perturb_threshold < 0) {
 	    if (ng0 < ng || ip || ngp > 0) {
@@ -3717,6 +5250,9 @@ int SolveStructure(char *fn, char *hfn,
 	dim0[i] = 0;
       }
       double mth = perturb_threshold;
+      if (perturb_cache) {
+	_hcache = calloc(MAX_SYMMETRIES, sizeof(HAMCACHE));
+      }
       for (iter = 0; iter < perturb_maxiter; iter++) {
 	int alldone = 1;
 	for (i = 0; i < ns; i++) {
@@ -3743,6 +5279,7 @@ int SolveStructure(char *fn, char *hfn,
 	    done[i] = 1;
 	    continue;
 	  }
+	  if (_hcache) HamCacheFill(h);
 	  isp0 = malloc(sizeof(int)*h->n_basis);
 	  isp1 = malloc(sizeof(int)*h->n_basis);
 	  h->ohsize = h->hsize;
@@ -3814,8 +5351,6 @@ int SolveStructure(char *fn, char *hfn,
 		h->exp_dim++;
 	      }
 	    }
-	    AllocHamMem(h, -1, -1);
-	    AllocHamMem(h, 0, 0);
 	    h->perturb_iter = iter;
 	    k = ConstructHamilton(i, -1, np0, isp0, np1, isp1, md);
 	  }
@@ -3843,7 +5378,7 @@ int SolveStructure(char *fn, char *hfn,
 	    h = GetHamilton(i);
 	    if (h->dim <= 0) continue;
 	    int skip = SkipMPI();
-	    if (skip) continue;
+	    if (skip && !h->hdist) continue;
 	    double wt0 = WallTime();
 	    if (!done[i]) {
 	      double emin = h->diag_emin;
@@ -3898,6 +5433,8 @@ int SolveStructure(char *fn, char *hfn,
     }
   }
 
+  FreeHamCache();
+  FreeHamiltonReuse();
   if (hfn != NULL && rh == 0) {
     WriteHamilton(hfn, ng0, ng, kg, ngp, kgp);
   }
@@ -3989,26 +5526,155 @@ int SaveEBLevels(char *fn, int m, int n) {
   return 0;
 }
 
-int SaveLevels(char *fn, int m, int n) {
-  STATE *s, *s1, sp;
+/* ibase search, energy adjustment and level names of level i. only
+   reads levels_per_ion and the ecorrections, so that it can run
+   concurrently for levels of the same number of electrons. */
+static int SaveLevelRecord(int i, int ecorr, EN_RECORD *r) {
+  STATE *s, *s1;
   SYMMETRY *sym, *sym1;
   CONFIG *cfg, *cfg1;
   SHELL_STATE *csf, *csf1;
   LEVEL *lev, *lev1;
+  ECORRECTION *ec;
+  LEVEL_ION *gion;
+  ORBITAL *orb;
+  double md, md1, a;
+  char name[LEVEL_NAME_LEN];
+  char sname[LEVEL_NAME_LEN];
+  char nc[LEVEL_NAME_LEN];
+  int p, j0, nele, vnl, ib, dn, ik;
+  int si, ms, mst, t, q, nk;
+
+  lev = GetLevel(i);
+  si = lev->pb;
+  sym = GetSymmetry(lev->pj);
+  s = (STATE *) ArrayGet(&(sym->states), si);
+  if (s->kgroup > 0) {
+    cfg = GetConfig(s);
+    nk = cfg->n_electrons-1;
+    if (nk < 0 ||
+	levels_per_ion[nk].dim == 0 ||
+	cfg->shells[0].nq > 1) {
+      lev->ibase = -1;
+    } else {
+      csf = cfg->csfs + s->kstate;
+      md = 1E30;
+      lev->ibase = -1;
+      dn = cfg->shells[0].n - cfg->shells[1].n;
+      a = 0.0;
+      if (dn < MAXDN) {
+	a = 0.0;
+	for (t = 0; t < lev->n_basis; t++) {
+	  s1 = ArrayGet(&(sym->states), lev->basis[t]);
+	  cfg1 = GetConfig(s1);
+	  if (cfg1->shells[0].n == cfg->shells[0].n &&
+	      cfg1->shells[0].nq == 1) {
+	    a += (lev->mixing[t])*(lev->mixing[t]);
+	  }
+	}
+	a = 1.0/a;
+      }
+      for (ib = 0; ib < NPRINCIPLE; ib++) {
+	for (t = 0; t < levels_per_ion[nk].dim; t++) {
+	  gion = (LEVEL_ION *) ArrayGet(levels_per_ion+nk, t);
+	  for (q = gion->imin; q <= gion->imax; q++) {
+	    lev1 = GetLevel(q);
+	    sym1 = GetSymmetry(lev1->pj);
+	    s1 = ArrayGet(&(sym1->states), lev1->basis[lev1->kpb[ib]]);
+	    cfg1 = GetConfig(s1);
+	    csf1 = cfg1->csfs + s1->kstate;
+	    mst = cfg1->n_shells*sizeof(SHELL_STATE);
+	    ms = cfg1->n_shells*sizeof(SHELL);
+	    if (cfg->n_shells == cfg1->n_shells+1 &&
+		memcmp(cfg->shells+1, cfg1->shells, ms) == 0 &&
+		memcmp(csf+1, csf1, mst) == 0) {
+	      if (dn < MAXDN) {
+		md1 = fabs(fabs(a*lev->mixing[lev->kpb[0]]) -
+			   fabs(lev1->mixing[lev1->kpb[ib]]));
+		if (md1 < md) {
+		  md = md1;
+		  lev->ibase = q;
+		}
+	      } else {
+		ik = OrbitalIndex(cfg->shells[0].n, cfg->shells[0].kappa, 0.0);
+		orb = GetOrbital(ik);
+		a = lev->energy - orb->energy;
+		for (p = 0; p < ecorrections->dim; p++) {
+		  ec = (ECORRECTION *) ArrayGet(ecorrections, p);
+		  if (-(q+1) == ec->ilev) {
+		    a += ec->e;
+		    break;
+		  }
+		}
+		md1 = fabs(lev1->energy - a);
+		if (md1 < md) {
+		  md = md1;
+		  lev->ibase = q;
+		}
+	      }
+	    }
+	  }
+	}
+	if (lev->ibase >= 0) {
+	  break;
+	}
+      }
+    }
+
+    if (!ecorr && lev->ibase >= 0) {
+      for (p = 0; p < ecorrections->dim; p++) {
+	ec = (ECORRECTION *) ArrayGet(ecorrections, p);
+	if (-(i+1) == ec->ilev) break;
+	if (-(lev->ibase + 1) == ec->ilev && cfg->shells[0].n >= ec->nmin) {
+	  lev->energy += ec->e;
+	  break;
+	}
+      }
+    }
+  } else {
+    lev->ibase = -(s->kgroup + 1);
+  }
+
+  DecodePJ(lev->pj, &p, &j0);
+  r->ilev = i;
+  r->ibase = lev->ibase;
+  r->p = p;
+  r->j = j0;
+  r->energy = lev->energy;
+
+  nele = ConstructLevelName(level_name?name:NULL, sname, nc, &vnl, s);
+  if (!level_name) name[0] = '\0';
+  strncpy(r->name, name, LNAME);
+  strncpy(r->sname, sname, LSNAME);
+  strncpy(r->ncomplex, nc, LNCOMPLEX);
+  r->name[LNAME-1] = '\0';
+  r->sname[LSNAME-1] = '\0';
+  r->ncomplex[LNCOMPLEX-1] = '\0';
+  if (r->p == 0) {
+    r->p = vnl;
+  } else {
+    r->p = -vnl;
+  }
+  return nele;
+}
+
+int SaveLevels(char *fn, int m, int n) {
+  STATE *s, sp;
+  SYMMETRY *sym;
+  LEVEL *lev;
   EN_RECORD r;
   EN_HEADER en_hdr;
   F_HEADER fhdr;
   ECORRECTION *ec;
   LEVEL_ION *gion, gion1;
-  ORBITAL *orb;
-  double e0, md, md1, a;
+  double e0;
   char name[LEVEL_NAME_LEN];
   char sname[LEVEL_NAME_LEN];
   char nc[LEVEL_NAME_LEN];
   TFILE *f;
-  int i, k, p, j0;
-  int nele, nele0, vnl, ib, dn, ik;
-  int si, ms, mst, t, q, nk, n0;
+  int i, k, p;
+  int nele, nele0, vnl;
+  int t, q, nk, n0;
 
 #ifdef PERFORM_STATISTICS
   STRUCT_TIMING structt;
@@ -4042,7 +5708,8 @@ int SaveLevels(char *fn, int m, int n) {
       r.ibase = lev->ilev;
       r.energy = lev->energy;
 
-      nele = ConstructLevelName(name, sname, nc, &vnl, &sp);
+      nele = ConstructLevelName(level_name?name:NULL, sname, nc, &vnl, &sp);
+      if (!level_name) name[0] = '\0';
       strncpy(r.name, name, LNAME);
       strncpy(r.sname, sname, LSNAME);
       strncpy(r.ncomplex, nc, LNCOMPLEX);
@@ -4105,17 +5772,35 @@ int SaveLevels(char *fn, int m, int n) {
     return 0;
   }
 
-  for (k = 0; k < n; k++) {
-    i = m + k;
-    lev = GetLevel(i);
-    si = lev->pb;
-    sym = GetSymmetry(lev->pj);
-    s = (STATE *) ArrayGet(&(sym->states), si);
-    int ecorr = 0;
-    if (ncorrections > 0) {
-      for (p = 0; p < ecorrections->dim; p++) {
-	ec = (ECORRECTION *) ArrayGet(ecorrections, p);
-	if (ec->ilev == i) {
+  int nb, k0, k1, *ecs;
+  EN_RECORD *rs;
+  nb = save_block;
+  if (nb > n) nb = n;
+  if (nb < 1) nb = 1;
+  rs = malloc(sizeof(EN_RECORD)*nb);
+  ecs = malloc(sizeof(int)*nb);
+  for (k0 = 0; k0 < n; k0 = k1) {
+    nele = -1;
+    for (k1 = k0; k1 < n && k1-k0 < nb; k1++) {
+      i = m + k1;
+      lev = GetLevel(i);
+      sym = GetSymmetry(lev->pj);
+      s = (STATE *) ArrayGet(&(sym->states), lev->pb);
+      t = ConstructLevelName(NULL, NULL, NULL, NULL, s);
+      if (k1 > k0 && t != nele) break;
+      nele = t;
+      int ecorr = 0;
+      if (ncorrections > 0) {
+	for (p = 0; p < ecorrections->dim; p++) {
+	  ec = (ECORRECTION *) ArrayGet(ecorrections, p);
+	  if (ec->ilev == i) break;
+	}
+	if (p < ecorrections->dim) {
+	  /*
+	  ** a reference level earlier in the block gets its shift only
+	  ** in SaveLevelRecord, the block ends before this level.
+	  */
+	  if (k1 > k0 && ec->iref >= m+k0 && ec->iref < i) break;
 	  if (ec->ilev == ec->iref) {
 	    e0 = lev->energy;
 	  } else {
@@ -4127,116 +5812,24 @@ int SaveLevels(char *fn, int m, int n) {
 	  ec->ilev = -(ec->ilev+1);
 	  ncorrections -= 1;
 	  ecorr = 1;
-	  break;
 	}
       }
+      ecs[k1-k0] = ecorr;
     }
-
-    if (s->kgroup > 0) {
-      cfg = GetConfig(s);
-      nk = cfg->n_electrons-1;
-      if (nk < 0 ||
-	  levels_per_ion[nk].dim == 0 ||
-	  cfg->shells[0].nq > 1) {
-	lev->ibase = -1;
-      } else {
-	csf = cfg->csfs + s->kstate;
-	md = 1E30;
-	lev->ibase = -1;
-	dn = cfg->shells[0].n - cfg->shells[1].n;
-	a = 0.0;
-	if (dn < MAXDN) {
-	  a = 0.0;
-	  for (t = 0; t < lev->n_basis; t++) {
-	    s1 = ArrayGet(&(sym->states), lev->basis[t]);
-	    cfg1 = GetConfig(s1);
-	    if (cfg1->shells[0].n == cfg->shells[0].n &&
-		cfg1->shells[0].nq == 1) {
-	      a += (lev->mixing[t])*(lev->mixing[t]);
-	    }
-	  }
-	  a = 1.0/a;
-	}
-	for (ib = 0; ib < NPRINCIPLE; ib++) {
-	  for (t = 0; t < levels_per_ion[nk].dim; t++) {
-	    gion = (LEVEL_ION *) ArrayGet(levels_per_ion+nk, t);
-	    for (q = gion->imin; q <= gion->imax; q++) {
-	      lev1 = GetLevel(q);
-	      sym1 = GetSymmetry(lev1->pj);
-	      s1 = ArrayGet(&(sym1->states), lev1->basis[lev1->kpb[ib]]);
-	      cfg1 = GetConfig(s1);
-	      csf1 = cfg1->csfs + s1->kstate;
-	      mst = cfg1->n_shells*sizeof(SHELL_STATE);
-	      ms = cfg1->n_shells*sizeof(SHELL);
-	      if (cfg->n_shells == cfg1->n_shells+1 &&
-		  memcmp(cfg->shells+1, cfg1->shells, ms) == 0 &&
-		  memcmp(csf+1, csf1, mst) == 0) {
-		if (dn < MAXDN) {
-		  md1 = fabs(fabs(a*lev->mixing[lev->kpb[0]]) -
-			     fabs(lev1->mixing[lev1->kpb[ib]]));
-		  if (md1 < md) {
-		    md = md1;
-		    lev->ibase = q;
-		  }
-		} else {
-		  ik = OrbitalIndex(cfg->shells[0].n, cfg->shells[0].kappa, 0.0);
-		  orb = GetOrbital(ik);
-		  a = lev->energy - orb->energy;
-		  for (p = 0; p < ecorrections->dim; p++) {
-		    ec = (ECORRECTION *) ArrayGet(ecorrections, p);
-		    if (-(q+1) == ec->ilev) {
-		      a += ec->e;
-		      break;
-		    }
-		  }
-		  md1 = fabs(lev1->energy - a);
-		  if (md1 < md) {
-		    md = md1;
-		    lev->ibase = q;
-		  }
-		}
-	      }
-	    }
-	  }
-	  if (lev->ibase >= 0) {
-	    break;
-	  }
-	}
-      }
-
-      if (!ecorr && lev->ibase >= 0) {
-	for (p = 0; p < ecorrections->dim; p++) {
-	  ec = (ECORRECTION *) ArrayGet(ecorrections, p);
-	  if (-(i+1) == ec->ilev) break;
-	  if (-(lev->ibase + 1) == ec->ilev && cfg->shells[0].n >= ec->nmin) {
-	    lev->energy += ec->e;
-	    break;
-	  }
-	}
+    /* levels_per_ion only changes between blocks of different nele */
+#if USE_MPI == 2
+    ResetWidMPI();
+#pragma omp parallel default(shared) private(k)
+#endif
+    {
+      for (k = k0; k < k1; k++) {
+#if USE_MPI == 2
+	if (SkipMPI()) continue;
+#endif
+	SaveLevelRecord(m+k, ecs[k-k0], rs+k-k0);
       }
-    } else {
-      lev->ibase = -(s->kgroup + 1);
-    }
-
-    DecodePJ(lev->pj, &p, &j0);
-    r.ilev = i;
-    r.ibase = lev->ibase;
-    r.p = p;
-    r.j = j0;
-    r.energy = lev->energy;
-
-    nele = ConstructLevelName(name, sname, nc, &vnl, s);
-    strncpy(r.name, name, LNAME);
-    strncpy(r.sname, sname, LSNAME);
-    strncpy(r.ncomplex, nc, LNCOMPLEX);
-    r.name[LNAME-1] = '\0';
-    r.sname[LSNAME-1] = '\0';
-    r.ncomplex[LNCOMPLEX-1] = '\0';
-    if (r.p == 0) {
-      r.p = vnl;
-    } else {
-      r.p = -vnl;
     }
+    i = m + k0;
     if (nele != nele0) {
       if (nele0 >= 0) {
 	DeinitFile(f, &fhdr);
@@ -4261,8 +5854,12 @@ int SaveLevels(char *fn, int m, int n) {
       en_hdr.nele = nele;
       InitFile(f, &fhdr, &en_hdr);
     }
-    WriteENRecord(f, &r);
+    for (k = k0; k < k1; k++) {
+      WriteENRecord(f, rs+k-k0);
+    }
   }
+  free(rs);
+  free(ecs);
 
   DeinitFile(f, &fhdr);
   CloseFile(f, &fhdr);
@@ -4593,24 +6190,52 @@ int GetBasisTableLR(char *fn, int m0, int k0i, int ilev0, int ilev1) {
     }
   } else {
     if (mf == 0) {
+      /* lines are formatted in parallel in blocks of save_block and
+	 written in order */
+      int nb, k0, k1, bl;
+      char *lb, **ml;
+      nb = save_block;
+      if (nb < 1) nb = 1;
+      bl = 3*LEVEL_NAME_LEN+64;
       f = fopen(fn, "w");
       if (!f) return -1;
       nsym = MAX_SYMMETRIES;
       fprintf(f, "============Basis Table===========================\n");
+      lb = NULL;
       for (i = 0; i < nsym; i++) {
 	sym = GetSymmetry(i);
 	DecodePJ(i, &p, &j);
 	st = &(sym->states);
 	if (sym->n_states <= 0) continue;
 	fprintf(f, "# %4d   %2d %2d   %5d\n", i, p, j, sym->n_states);
-	for (k = 0; k < sym->n_states; k++) {
-	  s = (STATE *) ArrayGet(st, k);
-	  ConstructLevelName(name, sname, nc, NULL, s);
-	  fprintf(f, "%6d   %2d %2d   %5d %3d %5d %5d   %-32s %-48s %-s\n",
-		  i, p, j, k, s->kgroup, s->kcfg, s->kstate, nc, sname, name);
+	if (lb == NULL) lb = malloc(sizeof(char)*bl*nb);
+	for (k0 = 0; k0 < sym->n_states; k0 = k1) {
+	  k1 = k0 + nb;
+	  if (k1 > sym->n_states) k1 = sym->n_states;
+#if USE_MPI == 2
+	  ResetWidMPI();
+#pragma omp parallel default(shared) private(k, s, name, sname, nc)
+#endif
+	  {
+	    for (k = k0; k < k1; k++) {
+#if USE_MPI == 2
+	      if (SkipMPI()) continue;
+#endif
+	      s = (STATE *) ArrayGet(st, k);
+	      ConstructLevelName(name, sname, nc, NULL, s);
+	      snprintf(lb+(k-k0)*bl, bl,
+		       "%6d   %2d %2d   %5d %3d %5d %5d   %-32s %-48s %-s\n",
+		       i, p, j, k, s->kgroup, s->kcfg, s->kstate,
+		       nc, sname, name);
+	    }
+	  }
+	  for (k = k0; k < k1; k++) {
+	    fputs(lb+(k-k0)*bl, f);
+	  }
 	}
 	fprintf(f, "\n");
       }
+      if (lb) free(lb);
 
       fprintf(f, "============Mixing Coefficients===================\n");
       double e0 = 1e30;
@@ -4618,28 +6243,51 @@ int GetBasisTableLR(char *fn, int m0, int k0i, int ilev0, int ilev1) {
 	lev = GetLevel(i);
 	if (lev->energy < e0) e0 = lev->energy;
       }
-      for (i = ilev0; i <= ilev1; i++) {
-	lev = GetLevel(i);
-	sym = GetSymmetry(lev->pj);
-	DecodePJ(lev->pj, &p, &j);
-	double a = 0;
-	for (k = 0; k < lev->n_basis; k++) {
-	  a += lev->mixing[k]*lev->mixing[k];
-	}
-	fprintf(f, "# %4d   %3d %2d %2d   %5d %15.8E %12.5E\n",
-		i, lev->pj, p, j, lev->n_basis,
-		(lev->energy-e0)*HARTREE_EV, a);
-	a = 0;
-	for (k = 0; k < lev->n_basis; k++) {
-	  si = lev->basis[k];
-	  s = (STATE *) ArrayGet(&(sym->states), si);
-	  a += lev->mixing[k]*lev->mixing[k];
-	  fprintf(f, "%6d   %3d %2d %2d   %5d %5d %3d %5d %5d   %15.8E %15.8E\n",
-		  i, lev->pj, p, j, k, si,
-		  s->kgroup, s->kcfg, s->kstate, lev->mixing[k], a);
+      ml = malloc(sizeof(char *)*nb);
+      for (k0 = ilev0; k0 <= ilev1; k0 = k1) {
+	k1 = k0 + nb;
+	if (k1 > ilev1+1) k1 = ilev1+1;
+#if USE_MPI == 2
+	ResetWidMPI();
+#pragma omp parallel default(shared) private(i, k, p, j, si, s, lev, sym)
+#endif
+	{
+	  for (i = k0; i < k1; i++) {
+#if USE_MPI == 2
+	    if (SkipMPI()) continue;
+#endif
+	    char *c;
+	    lev = GetLevel(i);
+	    sym = GetSymmetry(lev->pj);
+	    DecodePJ(lev->pj, &p, &j);
+	    c = malloc(sizeof(char)*128*(lev->n_basis+2));
+	    ml[i-k0] = c;
+	    double a = 0;
+	    for (k = 0; k < lev->n_basis; k++) {
+	      a += lev->mixing[k]*lev->mixing[k];
+	    }
+	    c += sprintf(c, "# %4d   %3d %2d %2d   %5d %15.8E %12.5E\n",
+			 i, lev->pj, p, j, lev->n_basis,
+			 (lev->energy-e0)*HARTREE_EV, a);
+	    a = 0;
+	    for (k = 0; k < lev->n_basis; k++) {
+	      si = lev->basis[k];
+	      s = (STATE *) ArrayGet(&(sym->states), si);
+	      a += lev->mixing[k]*lev->mixing[k];
+	      c += sprintf(c, "%6d   %3d %2d %2d   %5d %5d %3d %5d %5d   "
+			   "%15.8E %15.8E\n",
+			   i, lev->pj, p, j, k, si,
+			   s->kgroup, s->kcfg, s->kstate, lev->mixing[k], a);
+	    }
+	    sprintf(c, "\n");
+	  }
+	}
+	for (i = k0; i < k1; i++) {
+	  fputs(ml[i-k0], f);
+	  free(ml[i-k0]);
 	}
-	fprintf(f, "\n");
       }
+      free(ml);
       fclose(f);
     } else {
       int ih0, ih1, ihd;
@@ -5104,26 +6752,20 @@ int AngularZMixStates(ANGZ_DATUM **ad, int ih1, int ih2) {
     OUT:
       if (ih1 != ih2) {
 	if (n > 0) {
-	  a[iz] = malloc(sizeof(ANGZ_ARY));
-	  a[iz]->az = ang;
-	  a[iz]->nz = n;
+	  a[iz] = PackAngularZMixAry(n, ang);
 	} else {
 	  a[iz] = NULL;
 	}
 	iz++;
       } else {
 	if (n > 0) {
-	  a[iz1] = malloc(sizeof(ANGZ_ARY));
-	  a[iz1]->az = ang;
-	  a[iz1]->nz = n;
 	  if (iz2 != iz1) {
-	    ang = malloc(sizeof(ANGULAR_ZMIX)*n);
-	    memcpy(ang, a[iz1]->az, sizeof(ANGULAR_ZMIX)*n);
-	    AngZSwapBraKet(n, ang, 0);
-	    a[iz2] = malloc(sizeof(ANGZ_ARY));
-	    a[iz2]->az = ang;
-	    a[iz2]->nz = n;
+	    ANGULAR_ZMIX *ang2 = malloc(sizeof(ANGULAR_ZMIX)*n);
+	    memcpy(ang2, ang, sizeof(ANGULAR_ZMIX)*n);
+	    AngZSwapBraKet(n, ang2, 0);
+	    a[iz2] = PackAngularZMixAry(n, ang2);
 	  }
+	  a[iz1] = PackAngularZMixAry(n, ang);
 	} else {
 	  a[iz1] = NULL;
 	  if (iz2 != iz1) {
@@ -5298,6 +6940,7 @@ int AngularZFreeBoundStates(ANGZ_DATUM **ad, int ih1, int ih2) {
 	a[iz] = malloc(sizeof(ANGZ_ARY));
 	a[iz]->az = ang;
 	a[iz]->nz = n;
+	a[iz]->pk = 0;
       } else {
 	a[iz] = NULL;
       }
@@ -5463,9 +7106,7 @@ int AngularZxZFreeBoundStates(ANGZ_DATUM **ad, int ih1, int ih2) {
       free(sket);
     END:
       if (n > 0) {
-	a[iz] = malloc(sizeof(ANGZ_ARY));
-	a[iz]->az = ang;
-	a[iz]->nz = n;
+	a[iz] = PackAngularZxZMixAry(n, ang);
       } else {
 	a[iz] = NULL;
       }
@@ -5546,6 +7187,7 @@ int PrepAngular(int n1, int *is1, int n2, int *is2) {
 	for (i = 0; i < ns; i++) {
 	  (ad->angz)[i] = malloc(sizeof(ANGZ_ARY));
 	  (ad->angz)[i]->nz = 0;
+	  (ad->angz)[i]->pk = 0;
 	  (ad->angz)[i]->az = NULL;
 	}
 	ad->ns = ns;
@@ -6117,7 +7759,8 @@ int AngularZMix(ANGULAR_ZMIX **ang, int lower, int upper, int mink, int maxk,
 	*mbk = NULL;
       }
     }
-    int idz0, idz;
+    int idz0, idz, nzbuf = 0;
+    ANGULAR_ZMIX *zbuf = NULL;
     for (i = 0; i < lev1->n_basis; i++) {
       mix1 = lev1->mixing[i];
       if (fabs(mix1) < angz_cut) continue;
@@ -6142,7 +7785,7 @@ int AngularZMix(ANGULAR_ZMIX **ang, int lower, int upper, int mink, int maxk,
 	}
 	if ((ad->angz)[isz]) {
 	  nz_sub = (ad->angz)[isz]->nz;
-	  ang_sub = (ad->angz)[isz]->az;
+	  ang_sub = UnpackAngularZMixAry((ad->angz)[isz], &zbuf, &nzbuf);
 	  for (m = 0; m < nz_sub; m++) {
 	    if (ang_sub[m].k > kmax || ang_sub[m].k < kmin) continue;
 	    r0 = ang_sub[m].coeff*a;
@@ -6165,6 +7808,7 @@ int AngularZMix(ANGULAR_ZMIX **ang, int lower, int upper, int mink, int maxk,
 	}
       }
     }
+    if (zbuf) free(zbuf);
     PackAngularZMix(&n, ang, nz);
 
     if (lev) {
@@ -6263,6 +7907,8 @@ int AngularZxZFreeBound(ANGULAR_ZxZMIX **ang, int lower, int upper) {
       free(ang_z);
     }
   } else {
+    int nzbuf = 0;
+    ANGULAR_ZxZMIX *zbuf = NULL;
     ns = AngularZxZFreeBoundStates(&ad, lev1->iham, lev2->iham);
     for (i = 0; i < lev1->n_basis; i++) {
       mix1 = lev1->mixing[i];
@@ -6278,7 +7924,7 @@ int AngularZxZFreeBound(ANGULAR_ZxZMIX **ang, int lower, int upper) {
 	isz = isz0 + ih2;
 	if ((ad->angz)[isz]) {
 	  nz_sub = (ad->angz)[isz]->nz;
-	  ang_sub = (ad->angz)[isz]->az;
+	  ang_sub = UnpackAngularZxZMixAry((ad->angz)[isz], &zbuf, &nzbuf);
 	  for (m = 0; m < nz_sub; m++) {
 	    r0 = ang_sub[m].coeff*r;
 	    if (fabs(r0) < angz_cut) continue;
@@ -6290,6 +7936,7 @@ int AngularZxZFreeBound(ANGULAR_ZxZMIX **ang, int lower, int upper) {
 	}
       }
     }
+    if (zbuf) free(zbuf);
   }
 
   PackAngularZxZMix(&n, ang, nz);
@@ -6481,6 +8128,232 @@ int PackAngularZFB(int *n, ANGULAR_ZFB **ang, int nz) {
   return 0;
 }
 
+static unsigned char *PutAngZVarint(unsigned char *p, int d) {
+  unsigned int u;
+
+  u = (((unsigned int) d) << 1) ^ (unsigned int) (d >> 31);
+  while (u >= 0x80) {
+    *p++ = (u & 0x7F) | 0x80;
+    u >>= 7;
+  }
+  *p++ = u;
+  return p;
+}
+
+static unsigned char *GetAngZTerm(unsigned char *p, int nf, int *v) {
+  int f, s;
+  unsigned int u;
+
+  for (f = 0; f < nf; f++) {
+    u = 0;
+    s = 0;
+    while (*p & 0x80) {
+      u |= ((unsigned int) (*p++ & 0x7F)) << s;
+      s += 7;
+    }
+    u |= ((unsigned int) *p++) << s;
+    v[f] += ((int) (u >> 1)) ^ -((int) (u & 1));
+  }
+  return p;
+}
+
+static ANGZ_PATTERN *AngZPattern(unsigned char *b, int nb) {
+  unsigned int h;
+  int i;
+  ANGZ_PATTERN *p;
+
+  h = 2166136261u;
+  for (i = 0; i < nb; i++) {
+    h = (h ^ b[i])*16777619u;
+  }
+  h &= ANGZ_NDICT-1;
+  SetLock(&angz_dict_lock[h%ANGZ_NLOCK]);
+  for (p = angz_dict[h]; p != NULL; p = p->next) {
+    if (p->nb == nb && memcmp(p->b, b, nb) == 0) break;
+  }
+  if (p == NULL) {
+    p = malloc(sizeof(ANGZ_PATTERN)+nb);
+    p->nb = nb;
+    memcpy(p->b, b, nb);
+    p->next = angz_dict[h];
+    angz_dict[h] = p;
+  }
+  ReleaseLock(&angz_dict_lock[h%ANGZ_NLOCK]);
+  return p;
+}
+
+static void FreeAngZDict(void) {
+  int i;
+  ANGZ_PATTERN *p, *q;
+
+  if (angz_dict == NULL) return;
+  for (i = 0; i < ANGZ_NDICT; i++) {
+    for (p = angz_dict[i]; p != NULL; p = q) {
+      q = p->next;
+      free(p);
+    }
+  }
+  free(angz_dict);
+  angz_dict = NULL;
+}
+
+static ANGZ_ARY *PackAngZAry(int n, int nf, int *v, double *c) {
+  int i, f, d, k;
+  unsigned char *b, *p;
+  ANGZ_ARY *a;
+
+  b = malloc(5*nf*n);
+  p = b;
+  for (i = 0; i < n; i++) {
+    for (f = 0; f < nf; f++) {
+      d = v[i*nf+f];
+      if (i > 0) d -= v[(i-1)*nf+f];
+      p = PutAngZVarint(p, d);
+    }
+  }
+  k = 1;
+  if (angz_pack > 1) {
+    k = 2;
+    for (i = 0; i < n; i++) {
+      if (fabs(c[i] - (float) c[i]) >= angz_cut) {
+	k = 1;
+	break;
+      }
+    }
+  }
+  if (k == 2) {
+    a = malloc(sizeof(ANGZ_ARY) + sizeof(float)*n);
+    float *fc = (float *) (a+1);
+    for (i = 0; i < n; i++) fc[i] = c[i];
+  } else {
+    a = malloc(sizeof(ANGZ_ARY) + sizeof(double)*n);
+    memcpy(a+1, c, sizeof(double)*n);
+  }
+  a->nz = n;
+  a->pk = k;
+  a->az = AngZPattern(b, p-b);
+  free(b);
+  return a;
+}
+
+static double AngZAryCoeff(ANGZ_ARY *a, int i) {
+  if (a->pk == 2) return ((float *) (a+1))[i];
+  return ((double *) (a+1))[i];
+}
+
+/*
+** the coefficient list of a state pair is stored in an ANGZ_ARY, packed
+** unless angz_pack is 0. ang is taken over by the returned array.
+*/
+ANGZ_ARY *PackAngularZMixAry(int n, ANGULAR_ZMIX *ang) {
+  int i, *v;
+  double *c;
+  ANGZ_ARY *a;
+
+  if (!angz_pack) {
+    a = malloc(sizeof(ANGZ_ARY));
+    a->nz = n;
+    a->pk = 0;
+    a->az = ang;
+    return a;
+  }
+  v = malloc(sizeof(int)*3*n);
+  c = malloc(sizeof(double)*n);
+  for (i = 0; i < n; i++) {
+    v[3*i] = ang[i].k;
+    v[3*i+1] = ang[i].k0;
+    v[3*i+2] = ang[i].k1;
+    c[i] = ang[i].coeff;
+  }
+  a = PackAngZAry(n, 3, v, c);
+  free(v);
+  free(c);
+  free(ang);
+  return a;
+}
+
+ANGZ_ARY *PackAngularZxZMixAry(int n, ANGULAR_ZxZMIX *ang) {
+  int i, *v;
+  double *c;
+  ANGZ_ARY *a;
+
+  if (!angz_pack) {
+    a = malloc(sizeof(ANGZ_ARY));
+    a->nz = n;
+    a->pk = 0;
+    a->az = ang;
+    return a;
+  }
+  v = malloc(sizeof(int)*5*n);
+  c = malloc(sizeof(double)*n);
+  for (i = 0; i < n; i++) {
+    v[5*i] = ang[i].k;
+    v[5*i+1] = ang[i].k0;
+    v[5*i+2] = ang[i].k1;
+    v[5*i+3] = ang[i].k2;
+    v[5*i+4] = ang[i].k3;
+    c[i] = ang[i].coeff;
+  }
+  a = PackAngZAry(n, 5, v, c);
+  free(v);
+  free(c);
+  free(ang);
+  return a;
+}
+
+/*
+** return the coefficient list of a, decoded into *buf if packed.
+*/
+ANGULAR_ZMIX *UnpackAngularZMixAry(ANGZ_ARY *a, ANGULAR_ZMIX **buf,
+				   int *nbuf) {
+  int i, v[3];
+  unsigned char *p;
+
+  if (a->pk == 0) return (ANGULAR_ZMIX *) a->az;
+  if (*nbuf < a->nz) {
+    if (*nbuf > 0) free(*buf);
+    *buf = malloc(sizeof(ANGULAR_ZMIX)*a->nz);
+    *nbuf = a->nz;
+  }
+  p = ((ANGZ_PATTERN *) a->az)->b;
+  v[0] = 0;
+  v[1] = 0;
+  v[2] = 0;
+  for (i = 0; i < a->nz; i++) {
+    p = GetAngZTerm(p, 3, v);
+    (*buf)[i].k = v[0];
+    (*buf)[i].k0 = v[1];
+    (*buf)[i].k1 = v[2];
+    (*buf)[i].coeff = AngZAryCoeff(a, i);
+  }
+  return *buf;
+}
+
+ANGULAR_ZxZMIX *UnpackAngularZxZMixAry(ANGZ_ARY *a, ANGULAR_ZxZMIX **buf,
+				       int *nbuf) {
+  int i, v[5];
+  unsigned char *p;
+
+  if (a->pk == 0) return (ANGULAR_ZxZMIX *) a->az;
+  if (*nbuf < a->nz) {
+    if (*nbuf > 0) free(*buf);
+    *buf = malloc(sizeof(ANGULAR_ZxZMIX)*a->nz);
+    *nbuf = a->nz;
+  }
+  p = ((ANGZ_PATTERN *) a->az)->b;
+  for (i = 0; i < 5; i++) v[i] = 0;
+  for (i = 0; i < a->nz; i++) {
+    p = GetAngZTerm(p, 5, v);
+    (*buf)[i].k = v[0];
+    (*buf)[i].k0 = v[1];
+    (*buf)[i].k1 = v[2];
+    (*buf)[i].k2 = v[3];
+    (*buf)[i].k3 = v[4];
+    (*buf)[i].coeff = AngZAryCoeff(a, i);
+  }
+  return *buf;
+}
+
 int AddToAngularZxZ(int *n, int *nz, ANGULAR_ZxZMIX **ang,
 		    int n_shells, int phase, SHELL_STATE *sbra,
 		    SHELL_STATE *sket, INTERACT_SHELL *s, int m) {
@@ -6585,8 +8458,12 @@ double FreeANGZARY(ANGZ_ARY *az) {
   double s = 0;
   if (az == NULL) return s;
   if (az->nz > 0) {
-    free(az->az);
-    s = sizeof(ANGULAR_ZMIX)*az->nz;
+    if (az->pk == 0) {
+      free(az->az);
+      s = sizeof(ANGULAR_ZMIX)*az->nz;
+    } else {
+      s = (az->pk == 1 ? sizeof(double) : sizeof(float))*az->nz;
+    }
     az->az = NULL;
     az->nz = 0;
   }
@@ -6648,6 +8525,12 @@ int InitAngZArray(void) {
     InitLock(&angz_array[i].lock);
     InitLock(&angzxz_array[i].lock);
   }
+  if (angz_dict == NULL) {
+    angz_dict = calloc(ANGZ_NDICT, sizeof(ANGZ_PATTERN *));
+  }
+  for (i = 0; i < ANGZ_NLOCK; i++) {
+    InitLock(&angz_dict_lock[i]);
+  }
 
   return 0;
 }
@@ -6673,6 +8556,10 @@ int FreeAngZArray(void) {
       }
       free(angmz_array);
     }
+    FreeAngZDict();
+    for (i = 0; i < ANGZ_NLOCK; i++) {
+      DestroyLock(&angz_dict_lock[i]);
+    }
     angz_dim = 0;
     angz_dim2 = 0;
   }
@@ -6790,6 +8677,26 @@ void ClearRMatrixLevels(int n) {
   }
 }
 
+/*
+** work arrays only grow, so that they are reused for the same symmetry
+** across the perturbation iterations.
+*/
+static int AllocHamWork(HAMILTON *h, size_t nw, size_t niw) {
+  if (nw > h->lwork0) {
+    if (h->lwork0 > 0) free(h->work);
+    h->lwork0 = nw;
+    h->work = (double *) malloc(sizeof(double)*nw);
+    if (!(h->work)) return -1;
+  }
+  if (niw > h->liwork0) {
+    if (h->liwork0 > 0) free(h->iwork);
+    h->liwork0 = niw;
+    h->iwork = (int *) malloc(sizeof(int)*niw);
+    if (!(h->iwork)) return -1;
+  }
+  return 0;
+}
+
 int AllocHamMem(HAMILTON *h, int hdim, int nbasis) {
   int jp, i;
   size_t t;
@@ -6807,6 +8714,8 @@ int AllocHamMem(HAMILTON *h, int hdim, int nbasis) {
     h->msize0 = 0;
     h->lwork = 0;
     h->liwork = 0;
+    h->lwork0 = 0;
+    h->liwork0 = 0;
     h->basis = NULL;
     h->hamilton = NULL;
     h->mixing = NULL;
@@ -6814,6 +8723,7 @@ int AllocHamMem(HAMILTON *h, int hdim, int nbasis) {
     h->iwork = NULL;
     h->heff = NULL;
     h->hsp = NULL;
+    h->hdist = 0;
     return 0;
   }
   if (hdim < 0) {
@@ -6823,10 +8733,10 @@ int AllocHamMem(HAMILTON *h, int hdim, int nbasis) {
     if (h->hsize0 > 0) {
       free(h->hamilton);
     }
-    if (h->lwork > 0) {
+    if (h->lwork0 > 0) {
       free(h->work);
     }
-    if (h->liwork > 0) {
+    if (h->liwork0 > 0) {
       free(h->iwork);
     }
     if (h->msize0 > 0) {
@@ -6844,6 +8754,10 @@ int AllocHamMem(HAMILTON *h, int hdim, int nbasis) {
   h->n_basis = nbasis;
 
   h->msize = h->dim * h->n_basis + h->dim;
+  if (diag_mode > 0 && h->n_basis > diag_nbm &&
+      diag_nlev > 0 && diag_nlev < h->dim) {
+    h->msize = diag_nlev * h->n_basis + diag_nlev;
+  }
   if (h->mixing == NULL) {
     h->msize0 = h->msize;
     h->mixing = (double *) malloc(sizeof(double)*(size_t)h->msize);
@@ -6854,20 +8768,18 @@ int AllocHamMem(HAMILTON *h, int hdim, int nbasis) {
   }
   if (!(h->mixing)) return -1;
   
+  if (h->hsp) {
+    FreeMatrix(h->hsp);
+    free(h->hsp);
+    h->hsp = NULL;
+  }
+  h->hdist = 0;
   if (diag_mode > 0 && h->n_basis > diag_nbm) {
     h->hsp = malloc(sizeof(MATRIX));
     InitMatrix(h->hsp, h->n_basis);
     h->lwork = h->n_basis*3;
     h->liwork = 2*h->n_basis;
-    if (h->work == NULL) {
-      h->work = (double *) malloc(sizeof(double)*(size_t)(h->lwork));
-      h->iwork = (int *) malloc(sizeof(int)*(size_t)(h->liwork));
-    } else if (h->n_basis > h->n_basis0) {
-      free(h->work);
-      free(h->iwork);
-      h->work = (double *) malloc(sizeof(double)*(size_t)(h->lwork));
-      h->iwork = (int *) malloc(sizeof(int)*(size_t)(h->liwork));
-    }    
+    if (AllocHamWork(h, h->lwork, h->liwork) < 0) return -1;
     if (h->basis == NULL) {
       h->n_basis0 = h->n_basis;
       h->basis = (int *) malloc(sizeof(int)*(size_t)(h->n_basis));
@@ -6894,6 +8806,10 @@ int AllocHamMem(HAMILTON *h, int hdim, int nbasis) {
   }
   if (!(h->hamilton)) return -1;
 
+  /*
+  ** lwork/liwork cover DSPEVD and DGEEV, the eigenvector and perturbation
+  ** scratch follows them.
+  */
   t = t*2;
   h->lwork = 1 + 10*hdim + t;
   h->liwork = 3 + 10*hdim;
@@ -6903,17 +8819,8 @@ int AllocHamMem(HAMILTON *h, int hdim, int nbasis) {
     wl += t + hdim*(nbasis-hdim);
     wi += nbasis-hdim;
   }
-  if (h->work == NULL) {
-    h->dim0 = h->dim;
-    h->work = (double *) malloc(sizeof(double)*(size_t)(h->lwork+wl));
-    h->iwork = (int *) malloc(sizeof(int)*(size_t)(h->liwork+wi));
-  } else if (h->dim > h->dim0 || h->n_basis > h->n_basis0) {
-    h->dim0 = h->dim;
-    free(h->work);
-    free(h->iwork);
-    h->work = (double *) malloc(sizeof(double)*(size_t)(h->lwork+wl));
-    h->iwork = (int *) malloc(sizeof(int)*(size_t)(h->liwork+wi));
-  }
+  h->dim0 = h->dim;
+  if (AllocHamWork(h, h->lwork+wl, h->liwork+wi) < 0) return -1;
 
   if (h->basis == NULL) {
     h->n_basis0 = h->n_basis;
@@ -6975,6 +8882,7 @@ int InitStructure(void) {
     _allhams[i].mmix = NULL;
     _allhams[i].perturb_iter = 0;
     _allhams[i].diag_iter = 0;
+    _allhams[i].diag_rank = -1;
 
   }
   return 0;
@@ -7049,6 +8957,58 @@ void SetOptionStructure(char *s, char *sp, int ip, double dp) {
     diag_mode = ip;
     return;
   }
+  if (0 == strcmp(s, "structure:diag_nlev")) {
+    diag_nlev = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_emax")) {
+    diag_emax = dp/HARTREE_EV;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_dtol")) {
+    diag_dtol = dp/HARTREE_EV;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_dmaxiter")) {
+    diag_dmaxiter = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_mixed")) {
+    diag_mixed = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_ftol")) {
+    diag_ftol = dp/HARTREE_EV;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_rmaxiter")) {
+    diag_rmaxiter = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_rnsub")) {
+    diag_rnsub = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_dcmin")) {
+    diag_dcmin = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:diag_dist")) {
+    diag_dist = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:ham_inc")) {
+    strncpy(ham_inc, sp, 255);
+    return;
+  }
+  if (0 == strcmp(s, "structure:sched_nmin")) {
+    sched_nmin = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:ham_screen")) {
+    ham_screen = ip;
+    return;
+  }
   if (0 == strcmp(s, "structure:diag_nzm")) {
     diag_nzm = ip;
     return;
@@ -7089,10 +9049,26 @@ void SetOptionStructure(char *s, char *sp, int ip, double dp) {
     angz_cut = dp;
     return;
   }
+  if (0 == strcmp(s, "structure:angz_pack")) {
+    angz_pack = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:perturb_cache")) {
+    perturb_cache = ip;
+    return;
+  }
   if (0 == strcmp(s, "structure:full_name")) {
     full_name = ip;
     return;
   }
+  if (0 == strcmp(s, "structure:level_name")) {
+    level_name = ip;
+    return;
+  }
+  if (0 == strcmp(s, "structure:save_block")) {
+    save_block = ip;
+    return;
+  }
   if (0 == strcmp(s, "structure:sort_levs")) {
     _sort_levs = ip;
     return;
@@ -44,6 +44,8 @@ typedef struct _HAMILTON_ {
   size_t msize0;
   size_t lwork;
   size_t liwork;
+  size_t lwork0;
+  size_t liwork0;
   int *basis;
   MATRIX *hsp;
   double *hamilton;
@@ -62,6 +64,8 @@ typedef struct _HAMILTON_ {
   int exp_dim;
   int diag_iter;
   int perturb_iter;
+  int hdist;
+  int diag_rank;
   double diag_etol;
   double diag_emin;
 } HAMILTON;
@@ -92,8 +96,14 @@ typedef struct _LEVEL_ION_ {
   int imax;
 } LEVEL_ION;
 
+/*
+** pk > 0 marks a packed coefficient list, see PackAngularZMixAry. az
+** then points to the shared index pattern, and the double (pk = 1) or
+** float (pk = 2) coefficients follow the ANGZ_ARY in the same block.
+*/
 typedef struct _ANGZ_ARY_ {
   int nz;
+  int pk;
   void *az;
 } ANGZ_ARY;
   
@@ -223,6 +233,12 @@ int CompareAngularZFB(const void *c1, const void *c2);
 int PackAngularZxZMix(int *n, ANGULAR_ZxZMIX **ang, int nz);
 int PackAngularZMix(int *n, ANGULAR_ZMIX **ang, int nz);
 int PackAngularZFB(int *n, ANGULAR_ZFB **ang, int nz);
+ANGZ_ARY *PackAngularZMixAry(int n, ANGULAR_ZMIX *ang);
+ANGZ_ARY *PackAngularZxZMixAry(int n, ANGULAR_ZxZMIX *ang);
+ANGULAR_ZMIX *UnpackAngularZMixAry(ANGZ_ARY *a, ANGULAR_ZMIX **buf,
+				   int *nbuf);
+ANGULAR_ZxZMIX *UnpackAngularZxZMixAry(ANGZ_ARY *a, ANGULAR_ZxZMIX **buf,
+				       int *nbuf);
 int AngularZFreeBound(ANGULAR_ZFB **ang, int lower, int upper);
 int AngularZMixStates(ANGZ_DATUM **ad, int ih1, int ih2);
 int AngZSwapBraKet(int nz, ANGULAR_ZMIX *ang, int p);
@@ -247,6 +263,7 @@ int SaveLevels(char *fn, int m, int n);
 int SaveEBLevels(char *fn, int m, int n);
 int SetAngZOptions(int n, double mc, double c);
 int SetAngZCut(double c);
+double GetAngZCut(void);
 int SetCILevel(int m);
 int SetMixCut(double c, double c2);
 void FreeHamsArray(void);
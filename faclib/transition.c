@@ -45,6 +45,12 @@ static struct {
   double eps;
 } transition_option = {DGAUGE, DMODE, ERANK, MRANK, TRCUT0, TRCUT};
 
+/* pre-screen of the transition pairs, 2 also prints the pruned count */
+static int _tr_prescreen = 1;
+static double _tr_prescreen_cut = 0.0;
+/* max size of the config connectivity table of the pre-screen */
+#define TRSCREEN_MAXCFG2 67108864.0
+
 typedef struct {
   TR_RECORD r;
   TR_EXTRA rx;
@@ -101,8 +107,149 @@ int GetTransitionMode(void) {
   return transition_option.mode;
 }
 
-int TRMultipoleUTA(double *strength, TR_EXTRA *rx, 
-		   int m, int lower, int upper, int *ks) {
+/*
+** per-thread table of the orbital-pair multipole integrals of the
+** pair loops in SaveTransition0. the values on the aw grid of an
+** orbital pair are taken once from the shared multipole array, the
+** level pairs then only interpolate them in aw, without the locks of
+** the shared array. the values are copied, since the shared array may
+** be freed at its size limit while the table is in use.
+*/
+typedef struct {
+  int m, k0, k1;
+  int n, g;
+  double ef, r;
+  double *y;
+} TR_RDATUM;
+
+typedef struct {
+  int n, nd;
+  double *awg;
+  TR_RDATUM *d;
+} TR_RADIAL;
+
+static void InitTRRadial(TR_RADIAL *rt, int n) {
+  int i;
+
+  rt->n = n;
+  rt->nd = 0;
+  GetAWGrid(&(rt->awg));
+  rt->d = malloc(sizeof(TR_RDATUM)*n);
+  for (i = 0; i < n; i++) {
+    rt->d[i].k0 = -1;
+  }
+}
+
+static void FreeTRRadial(TR_RADIAL *rt) {
+  int i;
+
+  for (i = 0; i < rt->n; i++) {
+    if (rt->d[i].k0 >= 0 && rt->d[i].y != NULL) free(rt->d[i].y);
+  }
+  free(rt->d);
+  rt->n = 0;
+  rt->nd = 0;
+}
+
+static TR_RDATUM *TRRadialSlot(TR_RADIAL *rt, int m, int k0, int k1) {
+  unsigned int h;
+  TR_RDATUM *d;
+
+  h = ((unsigned int) (k0*7919 + k1))*2654435761U + (unsigned int) m;
+  h &= rt->n-1;
+  while (1) {
+    d = rt->d + h;
+    if (d->k0 < 0) return d;
+    if (d->k0 == k0 && d->k1 == k1 && d->m == m) return d;
+    h = (h+1) & (rt->n-1);
+  }
+}
+
+static TR_RDATUM *TRRadialDatum(TR_RADIAL *rt, int m, int k0, int k1) {
+  int i, n;
+  double *y;
+  TR_RDATUM *d, *d0;
+  ORBITAL *orb0, *orb1;
+
+  d = TRRadialSlot(rt, m, k0, k1);
+  if (d->k0 >= 0) return d;
+  if (2*(rt->nd+1) > rt->n) {
+    n = rt->n;
+    d0 = rt->d;
+    rt->n = 2*n;
+    rt->d = malloc(sizeof(TR_RDATUM)*rt->n);
+    for (i = 0; i < rt->n; i++) {
+      rt->d[i].k0 = -1;
+    }
+    for (i = 0; i < n; i++) {
+      if (d0[i].k0 < 0) continue;
+      d = TRRadialSlot(rt, d0[i].m, d0[i].k0, d0[i].k1);
+      *d = d0[i];
+    }
+    free(d0);
+    d = TRRadialSlot(rt, m, k0, k1);
+  }
+  rt->nd++;
+  d->m = m;
+  d->k0 = k0;
+  d->k1 = k1;
+  d->n = 0;
+  d->g = 0;
+  d->ef = 0.0;
+  d->r = 0.0;
+  d->y = NULL;
+  if (transition_option.mode == M_NR && m != 1) {
+    d->r = MultipoleRadialNR(m, k0, k1, transition_option.gauge);
+    return d;
+  }
+  orb0 = GetOrbitalSolved(k0);
+  orb1 = GetOrbitalSolved(k1);
+  if (orb0->wfun == NULL || orb1->wfun == NULL) {
+    if (m == -1) {
+      d->r = MultipoleRadialNR(m, k0, k1, transition_option.gauge);
+    }
+    return d;
+  }
+  n = MultipoleRadialFRGrid(&y, m, k0, k1, transition_option.gauge);
+  if (n > 0) {
+    d->y = malloc(sizeof(double)*n);
+    memcpy(d->y, y, sizeof(double)*n);
+  }
+  d->n = n;
+  if (d->n > 1 && (orb0->n == 0 || orb1->n == 0)) {
+    d->ef = Max(orb0->energy, orb1->energy);
+    if (d->ef > 0.0) {
+      d->ef *= FINE_STRUCTURE_CONST;
+    } else {
+      d->ef = 0.0;
+    }
+  }
+  d->g = (transition_option.gauge == G_COULOMB && m < 0);
+  return d;
+}
+
+/* the same as MultipoleRadialNR/FR, through the table rt if given */
+static double TRRadial(TR_RADIAL *rt, double aw, int m, int k0, int k1) {
+  TR_RDATUM *d;
+  double r;
+
+  if (rt == NULL) {
+    if (transition_option.mode == M_NR && m != 1) {
+      return MultipoleRadialNR(m, k0, k1, transition_option.gauge);
+    }
+    return MultipoleRadialFR(aw, m, k0, k1, transition_option.gauge);
+  }
+  d = TRRadialDatum(rt, m, k0, k1);
+  if (d->n == 0) return d->r;
+  aw += d->ef;
+  r = InterpolateMultipole(aw, d->n, rt->awg, d->y);
+  if (d->g) r /= aw;
+  return r;
+}
+
+static int TRMultipoleUTA0(double *strength, TR_EXTRA *rx, 
+			   int m, int lower, int upper, int *ks,
+			   TR_RADIAL *rt) {
   int m2, ns, k0, k1, q1, q2;
   int p1, p2, j1, j2, ia, ib;
   LEVEL *lev1, *lev2;
@@ -177,11 +324,7 @@ int TRMultipoleUTA(double *strength, TR_EXTRA *rx,
     return -1;
   }
   
-  if (transition_option.mode == M_NR && m != 1) {
-    r = MultipoleRadialNR(m, k0, k1, transition_option.gauge);
-  } else {
-    r = MultipoleRadialFR(aw, m, k0, k1, transition_option.gauge);
-  }
+  r = TRRadial(rt, aw, m, k0, k1);
 
   *strength = sqrt((lev1->ilev+1.0)*q1*(j2+1.0-q2)/((j1+1.0)*(j2+1.0)))*r;
   
@@ -190,8 +333,13 @@ int TRMultipoleUTA(double *strength, TR_EXTRA *rx,
   return 0;
 }
 
-int TRMultipole(double *strength, double *energy,
-		int m, int lower, int upper) {
+int TRMultipoleUTA(double *strength, TR_EXTRA *rx, 
+		   int m, int lower, int upper, int *ks) {
+  return TRMultipoleUTA0(strength, rx, m, lower, upper, ks, NULL);
+}
+
+static int TRMultipole0(double *strength, double *energy,
+			int m, int lower, int upper, TR_RADIAL *rt) {
   int m0, m1, m2;
   int p1, p2, j1, j2;
   LEVEL *lev1, *lev2;
@@ -228,13 +376,7 @@ int TRMultipole(double *strength, double *energy,
     }
     for (i = 0; i < nz; i++) {
       if (ang[i].k != m2) continue;
-      if (transition_option.mode == M_NR && m != 1) {
-	r = MultipoleRadialNR(m, ang[i].k0, ang[i].k1, 
-			      transition_option.gauge);
-      } else {
-	r = MultipoleRadialFR(aw, m, ang[i].k0, ang[i].k1,
-			      transition_option.gauge);
-      }
+      r = TRRadial(rt, aw, m, ang[i].k0, ang[i].k1);
       s += r * ang[i].coeff;
     }
     if (nmk >= m2/2) {
@@ -271,13 +413,7 @@ int TRMultipole(double *strength, double *energy,
       s = 0.0;
       for (i = 0; i < nz; i++) {
 	if (ang[i].k != m2) continue;
-	if (transition_option.mode == M_NR && m != 1) {
-	  r = MultipoleRadialNR(m, ang[i].k0, ang[i].k1,
-				transition_option.gauge);
-	} else {
-	  r = MultipoleRadialFR(aw, m, ang[i].k0, ang[i].k1,
-				transition_option.gauge);
-	}
+	r = TRRadial(rt, aw, m, ang[i].k0, ang[i].k1);
 	s += r * ang[i].coeff;
       }
       if (nmk >= m2/2) {
@@ -306,6 +442,11 @@ int TRMultipole(double *strength, double *energy,
   return 0;
 }
 
+int TRMultipole(double *strength, double *energy,
+		int m, int lower, int upper) {
+  return TRMultipole0(strength, energy, m, lower, upper, NULL);
+}
+
 int TRMultipoleEB(double *strength, double *energy, int m, int lower, int upper) {
   LEVEL *lev1, *lev2;
   LEVEL *plev1, *plev2;
@@ -436,6 +577,7 @@ int SaveTransitionEB0(int nlow, int *low, int nup, int *up,
     } else {
       SetAWGrid(3, emin, emax);
     }
+    PrepMultipoleBessel(m);
   }
   fhdr.type = DB_TRF;
   strcpy(fhdr.symbol, GetAtomicSymbol());
@@ -485,12 +627,390 @@ int SaveTransitionEB0(int nlow, int *low, int nup, int *up,
   return 0;
 }
       
+/*
+** the records of the work units of SaveTransition0 are written in
+** the order of the units, whichever thread computes them. a finished
+** unit is held until all units before it are written. one thread at a
+** time writes the ready units, the others go on computing.
+*/
+typedef struct {
+  int n, next, writing, wid;
+  int *nr;
+  TR_DATUM **rd;
+  TFILE *f;
+  LOCK lock;
+} TR_ORDER;
+
+static void InitTROrder(TR_ORDER *o, int n, TFILE *f) {
+  int i;
+
+  o->n = n;
+  o->next = 0;
+  o->writing = 0;
+  o->wid = -1;
+  o->f = f;
+  o->nr = malloc(sizeof(int)*n);
+  o->rd = malloc(sizeof(TR_DATUM *)*n);
+  for (i = 0; i < n; i++) {
+    o->nr[i] = -1;
+    o->rd[i] = NULL;
+  }
+  InitLock(&o->lock);
+}
+
+static void FreeTROrder(TR_ORDER *o) {
+  free(o->nr);
+  free(o->rd);
+  DestroyLock(&o->lock);
+}
+
+/*
+** hand over the nr records rd of unit u, rd is freed once written.
+** records with lower < 0 are skipped.
+*/
+static void PutTROrder(TR_ORDER *o, int u, TR_DATUM *rd, int nr, int uta) {
+  int k, i, n, wid;
+  TR_DATUM *r;
+
+  wid = MPIRank(NULL);
+  SetLock(&o->lock);
+  o->rd[u] = rd;
+  o->nr[u] = nr;
+  if (o->writing) {
+    ReleaseLock(&o->lock);
+    return;
+  }
+  o->writing = 1;
+  if (o->wid != wid) {
+    /* the buffer of the previous writer goes out first */
+    if (o->wid >= 0) FFLUSH(o->f);
+    o->wid = wid;
+  }
+  while (o->next < o->n && o->nr[o->next] >= 0) {
+    k = o->next++;
+    r = o->rd[k];
+    n = o->nr[k];
+    o->rd[k] = NULL;
+    ReleaseLock(&o->lock);
+    for (i = 0; i < n; i++) {
+      if (r[i].r.lower < 0) continue;
+      WriteTRRecord(o->f, &(r[i].r), uta?&(r[i].rx):NULL);
+    }
+    if (r) free(r);
+    SetLock(&o->lock);
+  }
+  o->writing = 0;
+  ReleaseLock(&o->lock);
+}
+
+/*
+** pre-screen of the (lower, upper) pairs of SaveTransition0. besides
+** the energy, J and parity rules, a pair is dropped if no two configs
+** of the levels, each carrying a mixing coefficient whose product is
+** above the angz cut, differ by a single electron jump allowed for the
+** multipole. such pairs give no angular coefficients in AngularZMix.
+** with a positive prescreen_cut, pairs whose connected configs carry
+** a summed product of mixing norms below it are dropped as well, this
+** is an approximation and off by default.
+** the config rule is not used with the mbpt multipole corrections,
+** which are not one-body, nor for levels with free-bound basis states.
+*/
+typedef struct {
+  int p, j, nc;
+  int *kc;
+  double *mx;
+  double e;
+} TR_SLEVEL;
+
+typedef struct {
+  int m, ncfg;
+  int *cfg;
+  char *conn;
+  int *kc;
+  double *mx;
+  double cut;
+  TR_SLEVEL *low, *up;
+  long np, nj, nc;
+} TR_SCREEN;
+
+static int CompareTRCfg(const void *p1, const void *p2) {
+  int *i1, *i2;
+
+  i1 = (int *) p1;
+  i2 = (int *) p2;
+  if (i1[0] != i2[0]) return (i1[0] < i2[0])?-1:1;
+  if (i1[1] != i2[1]) return (i1[1] < i2[1])?-1:1;
+  return 0;
+}
+
+/* occupation of c2 in the shell i of c1 */
+static int ShellOccupation(CONFIG *c1, int i, CONFIG *c2) {
+  int j;
+
+  for (j = 0; j < c2->n_shells; j++) {
+    if (c2->shells[j].n == c1->shells[i].n &&
+	c2->shells[j].kappa == c1->shells[i].kappa) {
+      return c2->shells[j].nq;
+    }
+  }
+  return 0;
+}
+
+/* 1 if the multipole m may connect c1 and c2 */
+static int TRConfigConnected(CONFIG *c1, CONFIG *c2, int m) {
+  int i, q, d1, d2, k1, k2, j1, j2, l1, l2;
+
+  d1 = 0;
+  k1 = -1;
+  for (i = 0; i < c1->n_shells; i++) {
+    q = c1->shells[i].nq - ShellOccupation(c1, i, c2);
+    if (q > 0) {
+      d1 += q;
+      if (d1 > 1) return 0;
+      k1 = c1->shells[i].kappa;
+    }
+  }
+  d2 = 0;
+  k2 = -1;
+  for (i = 0; i < c2->n_shells; i++) {
+    q = c2->shells[i].nq - ShellOccupation(c2, i, c1);
+    if (q > 0) {
+      d2 += q;
+      if (d2 > 1) return 0;
+      k2 = c2->shells[i].kappa;
+    }
+  }
+  if (d1 != d2) return 0;
+  if (d1 == 0 || m == 0) return 1;
+  j1 = GetJFromKappa(k1);
+  j2 = GetJFromKappa(k2);
+  if (!Triangle(j1, j2, 2*abs(m))) return 0;
+  l1 = GetLFromKappa(k1)/2;
+  l2 = GetLFromKappa(k2)/2;
+  if (m > 0 && IsEven(l1+l2+m)) return 0;
+  if (m < 0 && IsOdd(l1+l2-m)) return 0;
+  return 1;
+}
+
+static void InitTRScreen(TR_SCREEN *sc, int m, int nlow, int *low,
+			 int nup, int *up) {
+  int i, j, k, n, nb, ic, *kc, *ks, nk[2], *lu[2];
+  LEVEL *lev;
+  STATE *st;
+  SYMMETRY *sym;
+  TR_SLEVEL *sl;
+  CONFIG *c0, *c1;
+  char *cl, *cu;
+  double a;
+
+  sc->m = m;
+  sc->np = 0;
+  sc->nj = 0;
+  sc->nc = 0;
+  sc->cut = GetAngZCut();
+  sc->ncfg = 0;
+  sc->cfg = NULL;
+  sc->conn = NULL;
+  sc->kc = NULL;
+  sc->mx = NULL;
+  sc->low = malloc(sizeof(TR_SLEVEL)*nlow);
+  if (up == low) {
+    sc->up = sc->low;
+  } else {
+    sc->up = malloc(sizeof(TR_SLEVEL)*nup);
+  }
+  nk[0] = nlow;
+  nk[1] = nup;
+  lu[0] = low;
+  lu[1] = up;
+  nb = 0;
+  for (k = 0; k < 2; k++) {
+    if (k == 1 && up == low) break;
+    sl = k?sc->up:sc->low;
+    for (i = 0; i < nk[k]; i++) {
+      lev = GetLevel(lu[k][i]);
+      DecodePJ(lev->pj, &(sl[i].p), &(sl[i].j));
+      sl[i].e = lev->energy;
+      sl[i].nc = -1;
+      if (lev->n_basis > 0) nb += lev->n_basis;
+    }
+  }
+  if (_tr_prescreen == 0 || GetMaxKMBPT() > 0 || nb == 0) return;
+
+  /* configs of each level, with the largest mixing coefficient */
+  sc->kc = malloc(sizeof(int)*2*nb);
+  sc->mx = malloc(sizeof(double)*2*nb);
+  n = 0;
+  for (k = 0; k < 2; k++) {
+    if (k == 1 && up == low) break;
+    sl = k?sc->up:sc->low;
+    for (i = 0; i < nk[k]; i++) {
+      lev = GetLevel(lu[k][i]);
+      if (lev->n_basis <= 0 || lev->iham < 0) continue;
+      sym = GetSymmetry(lev->pj);
+      sl[i].nc = 0;
+      sl[i].kc = sc->kc + 2*n;
+      sl[i].mx = sc->mx + 2*n;
+      for (j = 0; j < lev->n_basis; j++) {
+	a = fabs(lev->mixing[j]);
+	if (a < sc->cut) continue;
+	st = (STATE *) ArrayGet(&(sym->states), lev->basis[j]);
+	if (st->kgroup < 0) {
+	  sl[i].nc = -1;
+	  break;
+	}
+	for (ic = 0; ic < sl[i].nc; ic++) {
+	  if (sl[i].kc[2*ic] == st->kgroup &&
+	      sl[i].kc[2*ic+1] == st->kcfg) break;
+	}
+	if (ic == sl[i].nc) {
+	  sl[i].kc[2*ic] = st->kgroup;
+	  sl[i].kc[2*ic+1] = st->kcfg;
+	  sl[i].mx[2*ic] = a;
+	  sl[i].mx[2*ic+1] = a*a;
+	  sl[i].nc++;
+	} else {
+	  if (a > sl[i].mx[2*ic]) sl[i].mx[2*ic] = a;
+	  sl[i].mx[2*ic+1] += a*a;
+	}
+      }
+      for (ic = 0; ic < sl[i].nc; ic++) {
+	sl[i].mx[2*ic+1] = sqrt(sl[i].mx[2*ic+1]);
+      }
+      if (sl[i].nc > 0) n += sl[i].nc;
+    }
+  }
+  if (n == 0) return;
+
+  /* the sorted list of distinct configs */
+  sc->cfg = malloc(sizeof(int)*2*n);
+  memcpy(sc->cfg, sc->kc, sizeof(int)*2*n);
+  qsort(sc->cfg, n, sizeof(int)*2, CompareTRCfg);
+  sc->ncfg = 1;
+  for (i = 1; i < n; i++) {
+    if (CompareTRCfg(sc->cfg+2*i, sc->cfg+2*(sc->ncfg-1))) {
+      sc->cfg[2*sc->ncfg] = sc->cfg[2*i];
+      sc->cfg[2*sc->ncfg+1] = sc->cfg[2*i+1];
+      sc->ncfg++;
+    }
+  }
+  if (((double)sc->ncfg)*sc->ncfg > TRSCREEN_MAXCFG2) {
+    for (k = 0; k < 2; k++) {
+      sl = k?sc->up:sc->low;
+      for (i = 0; i < nk[k]; i++) sl[i].nc = -1;
+    }
+    return;
+  }
+  cl = malloc(sizeof(char)*sc->ncfg);
+  cu = malloc(sizeof(char)*sc->ncfg);
+  for (i = 0; i < sc->ncfg; i++) {
+    cl[i] = 0;
+    cu[i] = 0;
+  }
+  for (k = 0; k < 2; k++) {
+    if (k == 1 && up == low) break;
+    sl = k?sc->up:sc->low;
+    for (i = 0; i < nk[k]; i++) {
+      for (ic = 0; ic < sl[i].nc; ic++) {
+	ks = bsearch(sl[i].kc+2*ic, sc->cfg, sc->ncfg, sizeof(int)*2,
+		     CompareTRCfg);
+	j = (ks - sc->cfg)/2;
+	if (k == 0) cl[j] = 1;
+	if (k == 1 || up == low) cu[j] = 1;
+      }
+    }
+  }
+  /* one id per config, in place of the (kgroup, kcfg) pair */
+  kc = malloc(sizeof(int)*n);
+  for (i = 0; i < n; i++) {
+    ks = bsearch(sc->kc+2*i, sc->cfg, sc->ncfg, sizeof(int)*2,
+		 CompareTRCfg);
+    kc[i] = (ks - sc->cfg)/2;
+  }
+  for (k = 0; k < 2; k++) {
+    if (k == 1 && up == low) break;
+    sl = k?sc->up:sc->low;
+    for (i = 0; i < nk[k]; i++) {
+      if (sl[i].nc > 0) {
+	sl[i].kc = kc + (sl[i].kc - sc->kc)/2;
+      }
+    }
+  }
+  free(sc->kc);
+  sc->kc = kc;
+
+  sc->conn = malloc(sizeof(char)*sc->ncfg*sc->ncfg);
+  for (i = 0; i < sc->ncfg; i++) {
+    if (!cl[i]) continue;
+    c0 = GetConfigFromGroup(sc->cfg[2*i], sc->cfg[2*i+1]);
+    for (j = 0; j < sc->ncfg; j++) {
+      if (!cu[j]) continue;
+      c1 = GetConfigFromGroup(sc->cfg[2*j], sc->cfg[2*j+1]);
+      sc->conn[i*sc->ncfg+j] = TRConfigConnected(c0, c1, m);
+    }
+  }
+  free(cl);
+  free(cu);
+}
+
+static void FreeTRScreen(TR_SCREEN *sc) {
+  if (sc->up != sc->low) free(sc->up);
+  free(sc->low);
+  if (sc->cfg) free(sc->cfg);
+  if (sc->conn) free(sc->conn);
+  if (sc->kc) free(sc->kc);
+  if (sc->mx) free(sc->mx);
+}
+
+/*
+** 0 if the pair (i, j) must be computed, 1 if it fails the energy, J
+** or parity rules, 2 if it fails the config rule.
+*/
+static int PrescreenTR(TR_SCREEN *sc, int i, int j) {
+  TR_SLEVEL *a, *b;
+  int m, m2, ia, ib, nc;
+  double w;
+  char *c;
+
+  a = sc->low+i;
+  b = sc->up+j;
+  if (b->e <= a->e) return 1;
+  if (a->j == 0 && b->j == 0) return 1;
+  m = sc->m;
+  if (m != 0) {
+    m2 = 2*abs(m);
+    if (!Triangle(a->j, b->j, m2)) return 1;
+    if (m > 0 && IsEven(a->p+b->p+m)) return 1;
+    if (m < 0 && IsOdd(a->p+b->p-m)) return 1;
+  } else {
+    m2 = abs(a->j-b->j);
+    if (m2 == 0) m2 += 2;
+    if (m2 > transition_option.max_m && m2 > transition_option.max_e) {
+      return 1;
+    }
+  }
+  if (sc->conn == NULL || a->nc < 0 || b->nc < 0) return 0;
+  nc = 0;
+  w = 0.0;
+  for (ia = 0; ia < a->nc; ia++) {
+    c = sc->conn + a->kc[ia]*sc->ncfg;
+    for (ib = 0; ib < b->nc; ib++) {
+      if (c[b->kc[ib]] && a->mx[2*ia]*b->mx[2*ib] >= sc->cut) {
+	if (_tr_prescreen_cut <= 0) return 0;
+	w += a->mx[2*ia+1]*b->mx[2*ib+1];
+	nc++;
+      }
+    }
+  }
+  if (nc > 0 && w >= _tr_prescreen_cut) return 0;
+  return 2;
+}
+
 int SaveTransition0(int nlow, int *low, int nup, int *up, 
 		    char *fn, int m) {
   int i, j, k, jup;
   TFILE *f;
   LEVEL *lev1, *lev2;
-  TR_RECORD r;
   TR_EXTRA rx;
   TR_HEADER tr_hdr;
   F_HEADER fhdr;
@@ -501,6 +1021,8 @@ int SaveTransition0(int nlow, int *low, int nup, int *up,
   double ep, em, wp, wm, w0, de, cp, cm;
   CONFIG *c0, *c1;
   TR_DATUM *rd;
+  TR_ORDER tro;
+  TR_SCREEN scr;
   int mj = 0xFF000000, mn = 0xFFFFFF;
 
 #ifdef PERFORM_STATISTICS
@@ -542,6 +1064,7 @@ int SaveTransition0(int nlow, int *low, int nup, int *up,
   } else {
     SetAWGrid(3, emin, emax);
   }
+  PrepMultipoleBessel(m);
   
   fhdr.type = DB_TR;
   strcpy(fhdr.symbol, GetAtomicSymbol());
@@ -589,18 +1112,26 @@ int SaveTransition0(int nlow, int *low, int nup, int *up,
       nc1 = nc0;
       nic1 = nic0;
     }
+    InitTROrder(&tro, nic0*nic1, f);
     ResetWidMPI();
 #pragma omp parallel default(shared) private(imin, imax, jmin, jmax, lev1, lev2, c0, c1, ir, ntr, rd, ep, em, e0, wp, wm, w0, i, j, ic0, ic1, k, ir0, gf, j0, j1, nrs0, nrs1, de, cm, cp)
     {
+    TR_RADIAL rt;
+    InitTRRadial(&rt, 256);
     imin = 0;
     for (ic0 = 0; ic0 < nic0; ic0++) {
       imax = nc0[ic0];
-      jmin = 0;
       lev1 = GetLevel(low[imin]);
       c0 = GetConfigFromGroup(lev1->iham, lev1->pb);
       for (ic1 = 0; ic1 < nic1; ic1++) {
 	int skip = SkipMPI();
-	if (skip) continue;
+	if (skip) {
+#if USE_MPI == 1
+	  PutTROrder(&tro, ic0*nic1+ic1, NULL, 0, 1);
+#endif
+	  continue;
+	}
+	jmin = ic1>0?nc1[ic1-1]:0;
 	jmax = nc1[ic1];
 	lev2 = GetLevel(up[jmin]);
 	c1 = GetConfigFromGroup(lev2->iham, lev2->pb);
@@ -616,7 +1147,8 @@ int SaveTransition0(int nlow, int *low, int nup, int *up,
 	ir0 = -1;
 	for (i = imin; i < imax; i++) {
 	  for (j = jmin; j < jmax; j++) {
-	    k = TRMultipoleUTA(&gf, &(rd[ir].rx), m, low[i], up[j], rd[ir].ks);
+	    k = TRMultipoleUTA0(&gf, &(rd[ir].rx), m, low[i], up[j],
+				rd[ir].ks, &rt);
 	    if (k != 0) {
 	      rd[ir].r.lower = -1;
 	      rd[ir].r.upper = -1;
@@ -691,56 +1223,86 @@ int SaveTransition0(int nlow, int *low, int nup, int *up,
 	  }
 	}
 	qsort(rd, ntr, sizeof(TR_DATUM), CompareTRDatum);
-	ir = 0;
-	for (ir = 0; ir < ntr; ir++) {
-	  if (rd[ir].r.lower < 0) {
-	    continue;
-	  }
-	  WriteTRRecord(f, &(rd[ir].r), &(rd[ir].rx));
-	}
-	free(rd);
-	jmin = jmax;
+	PutTROrder(&tro, ic0*nic1+ic1, rd, ntr, 1);
       }
       imin = imax;
     }    
+    FreeTRRadial(&rt);
+    }
+    FreeTROrder(&tro);
     free(nc0);
     if (up != low) free(nc1);
-    }
   } else {
     //PrepAngZStates(nlow, low, nup, up);
+    InitTRScreen(&scr, m, nlow, low, nup, up);
+    InitTROrder(&tro, nup, f);
     ResetWidMPI();
-#pragma omp parallel default(shared) private(a, s, et, j, jup, trd, i, k, gf, r)
+#pragma omp parallel default(shared) private(a, s, et, j, jup, trd, i, k, gf, rd, ntr)
     {
+      long np = 0, nj = 0, nc = 0;
+      TR_RADIAL rt;
+      InitTRRadial(&rt, 256);
       a = malloc(sizeof(double)*nlow);
       s = malloc(sizeof(double)*nlow);
       et = malloc(sizeof(double)*nlow);
       for (j = 0; j < nup; j++) {
 	int skip = SkipMPI();
-	if (skip) continue;
+	if (skip) {
+#if USE_MPI == 1
+	  PutTROrder(&tro, j, NULL, 0, 0);
+#endif
+	  continue;
+	}
 	jup = LevelTotalJ(up[j]);
 	trd = 0.0;
 	for (i = 0; i < nlow; i++) {
 	  a[i] = 0.0;
 	  et[i] = 0.0;
-	  k = TRMultipole(s+i, et+i, m, low[i], up[j]);
+	  np++;
+	  if (_tr_prescreen) {
+	    k = PrescreenTR(&scr, i, j);
+	    if (k == 1) nj++;
+	    else if (k == 2) nc++;
+	    if (k) continue;
+	  }
+	  k = TRMultipole0(s+i, et+i, m, low[i], up[j], &rt);
 	  if (k != 0) continue;
 	  gf = OscillatorStrength(m, et[i], s[i], &(a[i]));
 	  a[i] /= jup+1.0;
 	  trd += a[i];
 	} 
-	if (trd < 1E-30) continue;
-	r.upper = up[j];
+	if (trd < 1E-30) {
+	  PutTROrder(&tro, j, NULL, 0, 0);
+	  continue;
+	}
+	rd = malloc(sizeof(TR_DATUM)*nlow);
+	ntr = 0;
 	for (i = 0; i < nlow; i++) {
 	  if (a[i] <= 0 || a[i] < (transition_option.eps * trd)) continue;
-	  r.lower = low[i];
-	  r.strength = s[i];
-	  WriteTRRecord(f, &r, NULL);
+	  rd[ntr].r.lower = low[i];
+	  rd[ntr].r.upper = up[j];
+	  rd[ntr].r.strength = s[i];
+	  ntr++;
 	}
+	PutTROrder(&tro, j, rd, ntr, 0);
       }      
       free(a);
       free(s);
       free(et);
+      FreeTRRadial(&rt);
+#pragma omp atomic
+      scr.np += np;
+#pragma omp atomic
+      scr.nj += nj;
+#pragma omp atomic
+      scr.nc += nc;
+    }
+    FreeTROrder(&tro);
+    if (_tr_prescreen > 1) {
+      MPrintf(-1, "TRPrescreen: m=%d pairs=%ld pruned=%ld %ld cfgs=%d\n",
+	      m, scr.np, scr.nj, scr.nc, scr.ncfg);
     }
+    FreeTRScreen(&scr);
   }
   DeinitFile(f, &fhdr);
   CloseFile(f, &fhdr);
@@ -1036,4 +1598,12 @@ int PolarizeCoeff(char *ifn, char *ofn, int i0, int i1) {
 }
   
 void SetOptionTransition(char *s, char *sp, int ip, double dp) {
+  if (0 == strcmp(s, "transition:prescreen")) {
+    _tr_prescreen = ip;
+    return;
+  }
+  if (0 == strcmp(s, "transition:prescreen_cut")) {
+    _tr_prescreen_cut = dp;
+    return;
+  }
 }
@@ -2022,6 +2022,37 @@ static int SelectLevels(PyObject *p, int **t) {
   return 0;
 }
   
+static PyObject *PMergeMBPT(PyObject *self, PyObject *args) {
+  PyObject *q, *t;
+  int i, n;
+  char *fn, **fn1;
+
+  if (sfac_file) {
+    SFACStatement("MergeMBPT", args, NULL);
+    Py_INCREF(Py_None);
+    return Py_None;
+  }
+
+  if (!(PyArg_ParseTuple(args, "sO", &fn, &q))) return NULL;
+  if (!PyList_Check(q)) return NULL;
+  n = PyList_Size(q);
+  if (n <= 0) return NULL;
+  fn1 = malloc(sizeof(char *)*n);
+  for (i = 0; i < n; i++) {
+    t = PyList_GetItem(q, i);
+    if (!PyUnicode_Check(t)) {
+      free(fn1);
+      return NULL;
+    }
+    fn1[i] = PyUnicode_AsString(t);
+  }
+  MergeMBPT(fn, n, fn1);
+  free(fn1);
+
+  Py_INCREF(Py_None);
+  return Py_None;
+}
+
 static PyObject *PCutMixing(PyObject *self, PyObject *args) {
   int nlev, n, *ilev, *kg;
   double c;
@@ -6266,6 +6297,7 @@ static struct PyMethodDef fac_methods[] = {
   {"Info", PInfo, METH_VARARGS},
   {"SetOption", PSetOption, METH_VARARGS},
   {"StructureMBPT", PStructureMBPT, METH_VARARGS},
+  {"MergeMBPT", PMergeMBPT, METH_VARARGS},
   {"TransitionMBPT", PTransitionMBPT, METH_VARARGS},
   {"MemENTable", PMemENTable, METH_VARARGS},
   {"LevelInfor", PLevelInfor, METH_VARARGS},
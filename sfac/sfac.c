@@ -3466,6 +3466,25 @@ static int PStructureMBPT(int argc, char *argv[], int argt[],
   return -1;
 }
 
+static int PMergeMBPT(int argc, char *argv[], int argt[], 
+		      ARRAY *variables) {
+  int i, n, t[MAXNARGS];
+  char *v[MAXNARGS];
+
+  if (argc != 2) return -1;
+  if (argt[0] != STRING || argt[1] != LIST) return -1;
+  n = DecodeArgs(argv[1], v, t, variables);
+  if (n <= 0) return -1;
+  for (i = 0; i < n; i++) {
+    if (t[i] != STRING) return -1;
+  }
+  i = MergeMBPT(argv[0], n, v);
+  for (n--; n >= 0; n--) {
+    free(v[n]);
+  }
+  return i;
+}
+
 static int PCutMixing(int argc, char *argv[], int argt[], 
 		      ARRAY *variables) {
   int nlev, n, *ilev, *kg;
@@ -5207,6 +5226,7 @@ static METHOD methods[] = {
   {"MemENTable", PMemENTable, METH_VARARGS},
   {"SetOption", PSetOption, METH_VARARGS},
   {"StructureMBPT", PStructureMBPT, METH_VARARGS},
+  {"MergeMBPT", PMergeMBPT, METH_VARARGS},
   {"TransitionMBPT", PTransitionMBPT, METH_VARARGS},
   {"OptimizeRadial", POptimizeRadial, METH_VARARGS},
   {"PrepAngular", PPrepAngular, METH_VARARGS},